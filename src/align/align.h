@@ -23,6 +23,7 @@ LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR P
 #include "../search/trace_pt_buffer.h"
 #include "../util/task_queue.h"
 #include "../basic/statistics.h"
+#include "../output/output.h"
 
 using std::vector;
 
@@ -117,26 +118,34 @@ void align_sequence_anchored(vector<Segment> &matches,
 
 struct Output_writer
 {
-	Output_writer(Output_stream* f) :
-		f_(f)
+	Output_writer(Output_stream* f, vector<Block_chunk> *chunks) :
+		f_(f),
+		chunks_(chunks)
 	{ }
-	void operator()(Text_buffer &buf)
+	template<typename _buffer>
+	void operator()(_buffer &buf)
 	{
+		if (buf.size() == 0)
+			return;
+		if (chunks_)
+			chunks_->push_back(Block_chunk(buf.first_query(), f_->tell(), buf.size()));
 		f_->write(buf.get_begin(), buf.size());
 		buf.clear();
 	}
 private:
 	Output_stream* const f_;
+	vector<Block_chunk>* const chunks_;
 };
 
 template<typename _buffer>
 struct Ring_buffer_sink
 {
-	Ring_buffer_sink(Output_stream *output_file):
-		writer(output_file),
-		queue(config.threads_ * 32, writer)
+	Ring_buffer_sink(Output_stream *output_file, vector<Block_chunk> *chunks):
+		writer(output_file, config.unordered_output ? chunks : 0),
+		queue(config.threads_ * 32, writer, !config.unordered_output)
 	{}
-	bool get(size_t &i, _buffer *& buffer, Trace_pt_list::Query_range &query_range)
+	template<typename _init>
+	bool get(size_t &i, _buffer *& buffer, _init &query_range)
 	{
 		return queue.get(i, buffer, query_range);
 	}
@@ -144,6 +153,10 @@ struct Ring_buffer_sink
 	{
 		queue.push(i);
 	}
+	void finish()
+	{
+		queue.finish();
+	}
 private:
 	Output_writer writer;
 	Task_queue<_buffer, Output_writer> queue;
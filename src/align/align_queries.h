@@ -43,21 +43,179 @@ void align_queries(Trace_pt_list::iterator begin,
 	}
 }
 
+/* Supplies the query ranges of all bins of the trace point buffer to the
+alignment threads. The next bin is loaded and sorted by a background thread
+while the current one is aligned, so that threads running out of work at the
+end of a bin continue with the next bin instead of waiting for the slowest
+thread. */
+struct Trace_pt_bins
+{
+
+	Trace_pt_bins(const Trace_pt_buffer &trace_pts):
+		trace_pts_ (trace_pts),
+		bin_ (0),
+		loaded_ (1),
+		exhausted_ (false),
+		closed_ (false),
+		temp_space_ (0),
+		loader_ (0)
+	{
+		pending_[0] = pending_[1] = 0;
+		load(0, config.threads_);
+		if(trace_pts.bins() > 1)
+			loader_ = new tthread::thread(loader_worker, (void*)this);
+	}
+
+	~Trace_pt_bins()
+	{
+		join();
+	}
+
+	struct Query_range
+	{
+		Query_range(Trace_pt_bins &parent):
+			parent_ (parent)
+		{ }
+		bool operator()()
+		{ return parent_.next(begin, end, slot); }
+		Trace_pt_list::iterator begin, end;
+		unsigned slot;
+	private:
+		Trace_pt_bins &parent_;
+	};
+
+	Query_range get_range()
+	{ return Query_range (*this); }
+
+	/* Marks a query range taken from the given slot as aligned. */
+	void done(unsigned slot)
+	{
+		mtx_.lock();
+		--pending_[slot];
+		mtx_.unlock();
+		cond_.notify_all();
+	}
+
+	/* Joins the loader thread. Must only be called after the alignment
+	threads have returned. */
+	void finish()
+	{
+		join();
+		statistics.max(Statistics::TEMP_SPACE, temp_space_);
+		if(!error_.empty())
+			throw std::runtime_error(error_);
+	}
+
+private:
+
+	/* Once the alignment threads have returned, the loader has either loaded
+	every bin or the threads stopped early because the output failed. In the
+	latter case it must not wait for bins that are never consumed. */
+	void join()
+	{
+		if(!loader_)
+			return;
+		mtx_.lock();
+		closed_ = true;
+		mtx_.unlock();
+		cond_.notify_all();
+		loader_->join();
+		delete loader_;
+		loader_ = 0;
+	}
+
+	/* Called by the task queue with its lock held. Returns false for the last
+	range of the last bin. */
+	bool next(Trace_pt_list::iterator &begin, Trace_pt_list::iterator &end, unsigned &slot)
+	{
+		mtx_.lock();
+		if(exhausted_) {
+			++bin_;
+			cond_.notify_all();
+			while(loaded_ <= bin_)
+				cond_.wait(mtx_);
+			exhausted_ = false;
+		}
+		slot = bin_ % 2;
+		++pending_[slot];
+		mtx_.unlock();
+		Trace_pt_list::Query_range r (v_[slot].get_range());
+		if(!r())
+			exhausted_ = true;
+		begin = r.begin;
+		end = r.end;
+		return !exhausted_ || bin_ + 1 < trace_pts_.bins();
+	}
+
+	/* Bins after the first are loaded while the alignment threads run and
+	are therefore sorted with a single thread. */
+	void load(unsigned bin, unsigned threads)
+	{
+		Trace_pt_list &v = v_[bin % 2];
+		log_stream << "Processing query bin " << bin+1 << '/' << trace_pts_.bins() << '\n';
+		task_timer timer ("Loading trace points", 3);
+		temp_space_ = std::max(temp_space_, (stat_type)trace_pts_.load(v, bin));
+		timer.go("Sorting trace points");
+		merge_sort(v.begin(), v.end(), threads);
+		v.init();
+	}
+
+	static void loader_worker(void *p)
+	{
+		Trace_pt_bins &b = *(Trace_pt_bins*)p;
+		for(unsigned bin=1;bin<b.trace_pts_.bins();++bin) {
+			const unsigned slot = bin % 2;
+			b.mtx_.lock();
+			while(!b.closed_ && (b.bin_ + 1 < bin || b.pending_[slot] > 0))
+				b.cond_.wait(b.mtx_);
+			const bool closed = b.closed_;
+			b.mtx_.unlock();
+			if(closed)
+				return;
+			try {
+				if(b.error_.empty())
+					b.load(bin, 1);
+			} catch(std::exception &e) {
+				b.error_ = e.what();
+			}
+			if(!b.error_.empty()) {
+				b.v_[slot].clear();
+				b.v_[slot].init();
+			}
+			b.mtx_.lock();
+			++b.loaded_;
+			b.mtx_.unlock();
+			b.cond_.notify_all();
+		}
+	}
+
+	const Trace_pt_buffer &trace_pts_;
+	Trace_pt_list v_[2];
+	unsigned bin_, loaded_, pending_[2];
+	bool exhausted_, closed_;
+	stat_type temp_space_;
+	string error_;
+	tthread::mutex mtx_;
+	tthread::condition_variable cond_;
+	tthread::thread *loader_;
+
+};
+
 #define Output_sink Ring_buffer_sink
 
 template<typename _buffer>
 struct Align_context
 {
-	Align_context(Trace_pt_list &trace_pts, Output_stream* output_file):
+	Align_context(Trace_pt_bins &trace_pts, Output_stream* output_file, vector<Block_chunk> *chunks):
 		trace_pts (trace_pts),
 		output_file (output_file),
-		sink (output_file)
+		sink (output_file, chunks)
 	{ }
 	void operator()(unsigned thread_id)
 	{
 		Statistics st;
 		size_t i=0;
-		Trace_pt_list::Query_range query_range (trace_pts.get_range());
+		Trace_pt_bins::Query_range query_range (trace_pts.get_range());
 		_buffer *buffer = 0;
 		while(sink.get(i, buffer, query_range)) {
 			try {
@@ -71,6 +229,7 @@ struct Align_context
 				default:
 					align_queries<1>(query_range.begin, query_range.end, *buffer, st);
 				}
+				trace_pts.done(query_range.slot);
 				sink.push(i);
 			}
 			catch (std::bad_alloc&) {
@@ -85,30 +244,29 @@ struct Align_context
 		}
 		statistics += st;
 	}
-	Trace_pt_list &trace_pts;
+	Trace_pt_bins &trace_pts;
 	Output_stream* output_file;
 	Output_sink<_buffer> sink;
 };
 
-void align_queries(const Trace_pt_buffer &trace_pts, Output_stream* output_file)
+void align_queries(const Trace_pt_buffer &trace_pts, Output_stream* output_file, vector<Block_chunk> *chunks = 0)
 {
-	Trace_pt_list v;
-	for(unsigned bin=0;bin<trace_pts.bins();++bin) {
-		log_stream << "Processing query bin " << bin+1 << '/' << trace_pts.bins() << '\n';
-		task_timer timer ("Loading trace points", 3);
-		statistics.max(Statistics::TEMP_SPACE, trace_pts.load(v, bin));
-		timer.go("Sorting trace points");
-		merge_sort(v.begin(), v.end(), config.threads_);
-		v.init();
-		timer.go("Computing alignments");
-		if(ref_header.n_blocks > 1) {
-			Align_context<Temp_output_buffer> context (v, output_file);
-			launch_thread_pool(context, config.threads_);
-		} else {
-			Align_context<Output_buffer> context (v, output_file);
-			launch_thread_pool(context, config.threads_);
-		}
+	Trace_pt_bins bins (trace_pts);
+	task_timer timer ("Computing alignments", 3);
+	if(chunks) {
+		Align_context<Temp_output_buffer> context (bins, output_file, chunks);
+		launch_thread_pool(context, config.threads_);
+		context.sink.finish();
+	} else if(direct_output()) {
+		Align_context<Text_output_buffer> context (bins, output_file, chunks);
+		launch_thread_pool(context, config.threads_);
+		context.sink.finish();
+	} else {
+		Align_context<Output_buffer> context (bins, output_file, chunks);
+		launch_thread_pool(context, config.threads_);
+		context.sink.finish();
 	}
+	bins.finish();
 }
 
 #endif /* ALIGN_QUERIES_H_ */
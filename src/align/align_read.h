@@ -20,6 +20,7 @@ LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR P
 #define ALIGN_READ_H_
 
 #include <vector>
+#include <map>
 #include <assert.h>
 #include "../util/async_buffer.h"
 #include "../basic/match.h"
@@ -27,6 +28,8 @@ LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR P
 #include "align.h"
 #include "../util/text_buffer.h"
 #include "../output/output_buffer.h"
+#include "../data/query_dedup.h"
+#include "../data/result_cache.h"
 #include "link_segments.h"
 
 // #define ENABLE_LOGGING_AR
@@ -37,6 +40,69 @@ LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR P
 
 using std::vector;
 
+/* Returns the position in a cluster member that corresponds to position pos
+of its representative, or -1 if none is found. Members may have indels or
+terminal extensions relative to the representative, so the position is taken
+from the ungapped diagonal with the most identities in a window around pos.
+Only diagonals within member_band of the main diagonal are searched, so
+members shifted further at this position, or aligning to the representative
+only with a gap close to it, are not expanded. */
+inline int member_position(const sequence &rep, const sequence &member, unsigned pos)
+{
+	enum { member_window = 16, member_band = 128 };
+	const int rep_begin = std::max((int)pos - member_window, 0),
+		rep_end = std::min((int)pos + member_window + 1, (int)rep.length()),
+		min_identities = (rep_end - rep_begin) / 2;
+	int best = min_identities - 1, best_d = 0;
+	for(int k = 0; k <= 2 * member_band; ++k) {
+		const int d = k % 2 ? (k + 1) / 2 : -k / 2;
+		if((int)pos + d < 0 || (int)pos + d >= (int)member.length())
+			continue;
+		int n = 0;
+		for(int i = std::max(rep_begin, -d); i < rep_end && i + d < (int)member.length(); ++i)
+			if(rep[i] == member[i + d])
+				++n;
+		if(n > best) {
+			best = n;
+			best_d = d;
+		}
+	}
+	return best >= min_identities ? (int)pos + best_d : -1;
+}
+
+/* Collects the seed hits of the cluster representatives that scored within
+config.cluster_expand of the reporting threshold, transferred to the
+corresponding positions of their members. */
+void expand_clusters(vector<hit> &dst,
+	const vector<Segment> &matches,
+	int min_score,
+	Trace_pt_buffer::Vector::iterator begin,
+	Trace_pt_buffer::Vector::iterator end)
+{
+	const Ref_clusters &clusters = ref_clusters::get();
+	const Sequence_set &seqs = ref_seqs::get();
+	std::map<unsigned,int> best;
+	for(vector<Segment>::const_iterator i = matches.begin(); i != matches.end(); ++i)
+		if(clusters.has_members(i->subject_id_)) {
+			int &s = best[i->subject_id_];
+			s = std::max(s, i->score_);
+		}
+	const int threshold = (int)(config.cluster_expand * min_score);
+	for(Trace_pt_buffer::Vector::iterator i = begin; i != end; ++i) {
+		const std::pair<size_t,size_t> l = seqs.local_position(i->subject_);
+		std::map<unsigned,int>::const_iterator b = best.find((unsigned)l.first);
+		if(b == best.end() || b->second < threshold)
+			continue;
+		const sequence rep (seqs[l.first]);
+		for(unsigned m = clusters.member_begin(l.first); m < clusters.member_end(l.first); ++m) {
+			const int pos = member_position(rep, seqs[m], (unsigned)l.second);
+			if(pos >= 0)
+				dst.push_back(hit(i->query_, seqs.position(m, pos), i->seed_offset_));
+		}
+	}
+	std::stable_sort(dst.begin(), dst.end());
+}
+
 void align_read(Output_buffer &buffer,
 		Statistics &stat,
 		Trace_pt_buffer::Vector::iterator &begin,
@@ -44,6 +110,8 @@ void align_read(Output_buffer &buffer,
 {
 	static TLS_PTR vector<local_match> *local_ptr = 0;
 	static TLS_PTR vector<Segment> *matches_ptr = 0;
+	static TLS_PTR vector<hit> *member_hits_ptr = 0;
+	static TLS_PTR vector<local_match> *member_local_ptr = 0;
 
 #ifdef ENABLE_LOGGING_AR
 	static std::set<unsigned> q;
@@ -85,6 +153,21 @@ void align_read(Output_buffer &buffer,
 		}		
 		++i;
 	}
+
+	const int min_raw_score = score_matrix.rawscore(config.min_bit_score == 0
+			? score_matrix.bitscore(config.max_evalue, ref_header.letters, query_len) : config.min_bit_score);
+
+	if(ref_clusters::data_ != 0 && matches.size() > 0) {
+		vector<hit> &member_hits (get_tls(member_hits_ptr));
+		vector<local_match> &member_local (get_tls(member_local_ptr));
+		member_hits.clear();
+		member_local.clear();
+		expand_clusters(member_hits, matches, min_raw_score, begin, end);
+		member_local.reserve(member_hits.size());
+		Map_t member_map (member_hits.begin(), member_hits.end());
+		for(Map_t::Iterator j = member_map.begin(); j.valid(); ++j)
+			align_sequence_anchored(matches, stat, member_local, padding, db_letters, source_query_len, j.begin(), j.end());
+	}
 	
 	if(matches.size() == 0)
 		return;
@@ -94,8 +177,6 @@ void align_read(Output_buffer &buffer,
 	std::sort(matches.begin(), matches.end());
 	unsigned n_hsp = 0, n_target_seq = 0;
 	vector<Segment>::iterator it = matches.begin();
-	const int min_raw_score = score_matrix.rawscore(config.min_bit_score == 0
-			? score_matrix.bitscore(config.max_evalue, ref_header.letters, query_len) : config.min_bit_score);
 	const int top_score = matches.operator[](0).score_;
 
 	while(it < matches.end()) {
@@ -135,7 +216,7 @@ void align_read(Output_buffer &buffer,
 		buffer.finish_query_record();
 
 	stat.inc(Statistics::OUT_MATCHES, matches.size());
-	if(ref_header.n_blocks == 1) {
+	if(ref_header.n_blocks == 1 && Query_dedup::instance == 0 && Result_cache::instance == 0) {
 		stat.inc(Statistics::MATCHES, n_hsp);
 		stat.inc(Statistics::PAIRWISE, n_target_seq);
 		if(n_hsp > 0)
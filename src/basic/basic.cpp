@@ -25,7 +25,8 @@ LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR P
 
 const char* Const::version_string = "0.8.9";
 const char* Const::program_name = "diamond";
-const char* Const::id_delimiters = " \a\b\f\n\r\t\v";
+// \1 separates the titles of collapsed identical sequences.
+const char* Const::id_delimiters = " \a\b\f\n\r\t\v\1";
 
 Value_traits::Value_traits(const char *alphabet, Letter mask_char, const char *ignore) :
 	alphabet(alphabet),
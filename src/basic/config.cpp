@@ -58,6 +58,8 @@ Config::Config(int argc, const char **argv)
 	makedb.add()
 		("in", 0, "input reference file in FASTA format", input_ref_file)
 		("block-size", 'b', "sequence block size in billions of letters (default=2)", chunk_size)
+		("collapse-duplicates", 0, "store identical sequences of a block once, joining their titles", collapse_duplicates)
+		("clusters", 0, "tab-separated file of representative and member sequence ids; only representatives are indexed", clusters)
 #ifdef EXTRA
 		("dbtype", po::value<string>(&program_options::db_type), "database type (nucl/prot)")
 #endif
@@ -68,7 +70,7 @@ Config::Config(int argc, const char **argv)
 		("query",'q', "input query file", query_file)
 		("max-target-seqs",'k', "maximum number of target sequences to report alignments for", max_alignments, uint64_t(25))
 		("top", 0, "report alignments within this percentage range of top alignment score (overrides --max-target-seqs)", toppercent, 100.0)
-		("compress", 0, "compression for output files (0=none, 1=gzip)", compression)
+		("compress", 0, "compression for output files (0=none, 1=gzip; block-compressed alignments for DAA files)", compression)
 		("evalue",'e', "maximum e-value to report alignments", max_evalue, 0.001)
 		("min-score", 0, "minimum bit score to report alignments (overrides e-value setting)", min_bit_score)
 		("id", 0, "minimum identity% to report an alignment", min_id)
@@ -96,6 +98,7 @@ Config::Config(int argc, const char **argv)
 		("xdrop", 'x', "xdrop for ungapped alignment", xdrop, 20)
 		("gapped-xdrop",'X', "xdrop for gapped alignment in bits", gapped_xdrop, 20)
 		("ungapped-score", 0, "minimum raw alignment score to continue local extension", min_ungapped_raw_score)
+		("cluster-expand", 0, "align the members of a cluster representative scoring above this fraction of the reporting threshold", cluster_expand, 0.8)
 		("hit-band", 0, "band for hit verification", hit_band)
 		("hit-score",0, "minimum score to keep a tentative alignment", min_hit_score)
 		("band", 0, "band for dynamic programming computation", padding)
@@ -105,13 +108,23 @@ Config::Config(int argc, const char **argv)
 		("rank-factor", 0 , "include subjects within this range of max-target-seqs", rank_factor, 2.0)
 		("rank-ratio", 0, "include subjects within this ratio of last hit", rank_ratio, 0.35)
 		("single-domain", 0, "Discard secondary domains within one target sequence", single_domain)
+		("unordered", 0, "write query records in order of completion instead of input order", unordered_output)
+		("csr-index", 0, "store seed index as key directory and position array", csr_index)
+		("query-filter", 0, "index only reference seeds that occur in the query set", query_filter)
+		("query-index-cache", 0, "memory limit in GB for keeping query indexes across reference blocks (0 = disabled)", query_index_cache)
+		("ref-major", 0, "load all query chunks and read each reference block only once", ref_major)
+		("prefetch", 0, "load the next reference block in the background (keeps two blocks in memory)", prefetch)
+		("diagonal-cache", 0, "skip extension of seed hits inside already reported ungapped extents", diagonal_cache)
+		("shape-early-stop", 0, "do not search queries with further shapes once they have strong seed hits in max-target-seqs subjects", shape_early_stop)
+		("query-dedup", 0, "search only one copy of identical query sequences", query_dedup)
+		("result-cache", 0, "directory of a persistent cache that reuses the results of queries searched before", result_cache)
 		("dbsize", 0, "effective database size (in letters)", db_size)
 		("no-auto-append", 0, "disable auto appending of DAA and DMND file extensions", no_auto_append);
 	
 	Options_group view_options("View options");
 	view_options.add()
-		("out", 'o', "output file", output_file)
-		("outfmt",'f', "output format (tab/sam/xml)", output_format, string("tab"))
+		("out", 'o', "output file (blastp/blastx write to it directly if --daa is omitted)", output_file)
+		("outfmt",'f', "output format (tab/sam/xml/bam/hits)", output_format, string("tab"))
 		("forwardonly", 0, "only show alignments of forward strand", forwardonly);
 
 	Options_group hidden_options("");
@@ -137,6 +150,7 @@ Config::Config(int argc, const char **argv)
 	else if (verbose)
 		verbosity = 2;
 	else if ((command == Config::view && output_file == "")
+		|| ((command == Config::blastp || command == Config::blastx) && daa_file == "" && output_file == "")
 		|| command == Config::version)
 		verbosity = 0;
 	else
@@ -170,6 +184,11 @@ Config::Config(int argc, const char **argv)
 			throw std::runtime_error("Missing parameter: database file (--db/-d)");
 		if (chunk_size != 0)
 			std::cerr << "Warning: --block-size option should be set for the makedb command." << endl;
+		if (daa_file == "" && (output_format == "xml" || output_format == "bam"))
+			throw std::runtime_error("XML and BAM output require a DAA file (--daa/-a).");
+		if (shape_early_stop && toppercent < 100)
+			throw std::runtime_error("--shape-early-stop cannot be used together with --top.");
+		break;
 	case Config::view:
 		if (daa_file == "")
 			throw std::runtime_error("Missing parameter: DAA file (--daa/-a)");
@@ -187,7 +206,8 @@ Config::Config(int argc, const char **argv)
 
 	if (!no_auto_append) {
 		auto_append_extension(database, ".dmnd");
-		auto_append_extension(daa_file, ".daa");
+		if (daa_file != "")
+			auto_append_extension(daa_file, ".daa");
 	}
 
 	message_stream << Const::program_name << " v" << Const::version_string << "." << (unsigned)Const::build_version << " | by Benjamin Buchfink <buchfink@gmail.com>" << endl; 
@@ -209,7 +229,7 @@ Config::Config(int argc, const char **argv)
 
 	if (command == Config::blastp || command == Config::blastx || command == Config::benchmark) {
 		if (tmpdir == "")
-			tmpdir = extract_dir(daa_file);
+			tmpdir = extract_dir(daa_file == "" ? output_file : daa_file);
 		if (gap_open == -1)
 			gap_open = 11;
 		if (gap_extend == -1)
@@ -92,6 +92,19 @@ struct Config
 	unsigned seq_no;
 	double rank_factor;
 	double rank_ratio;
+	bool unordered_output;
+	bool csr_index;
+	bool query_filter;
+	double query_index_cache;
+	bool ref_major;
+	bool prefetch;
+	bool diagonal_cache;
+	bool shape_early_stop;
+	bool query_dedup;
+	bool collapse_duplicates;
+	string clusters;
+	double cluster_expand;
+	string result_cache;
 
 	enum { makedb = 0, blastp = 1, blastx = 2, view = 3, help = 4, version = 5, getseq = 6, benchmark = 7, random_seqs = 8 };
 	unsigned	command;
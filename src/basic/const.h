@@ -25,8 +25,10 @@ struct Const
 	enum {
 		build_version = 71,
 		build_compatibility = 52,
+		// Database build of clustered databases, which older builds cannot read.
+		cluster_build = 72,
 		db_version = 0,
-		daa_version = 0,
+		daa_version = 1,
 		seedp_bits = 10,
 		seedp = 1<<seedp_bits,
 		max_seed_weight = 32,
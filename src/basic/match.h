@@ -162,10 +162,11 @@ struct Hsp_data
 
 struct Hsp_context
 {
-	Hsp_context(const Hsp_data& hsp, const sequence &query, const char *query_name, const char *subject_name, unsigned subject_len, unsigned hit_num, unsigned hsp_num) :
+	Hsp_context(const Hsp_data& hsp, const sequence &query, const char *query_name, unsigned subject_id, const char *subject_name, unsigned subject_len, unsigned hit_num, unsigned hsp_num) :
 		query(query),
 		query_name(query_name),
 		subject_name(subject_name),
+		subject_id(subject_id),
 		subject_len(subject_len),
 		hit_num(hit_num),
 		hsp_num(hsp_num),
@@ -272,7 +273,7 @@ struct Hsp_context
 
 	const sequence query;
 	const char *query_name, *subject_name;
-	const unsigned subject_len, hit_num, hsp_num;
+	const unsigned subject_id, subject_len, hit_num, hsp_num;
 private:	
 	const Hsp_data &hsp_;
 };
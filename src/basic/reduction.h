@@ -45,6 +45,8 @@ struct Reduction
 				map_[(long)value_traits.from_char(ch)] = i;
 				map8_[(long)value_traits.from_char(ch)] = i;
 			}
+		for (unsigned i = 0; i < 256; ++i)
+			seed_map_[i] = (Letter)i == value_traits.mask_char || i == 0xff ? 0xff : (uint8_t)map_[i & 0x7F];
 	}
 
 	unsigned size() const
@@ -62,6 +64,13 @@ struct Reduction
 		return map8_;
 	}
 
+	/* Maps a sequence letter, including a set critical bit, to its reduced
+	letter for seed computation, or to 0xff if no seed may contain it. */
+	uint8_t seed_letter(Letter a) const
+	{
+		return seed_map_[(uint8_t)a];
+	}
+
 	inline friend std::ostream& operator<<(std::ostream &os, const Reduction &r)
 	{
 		for (unsigned i = 0; i < r.size_; ++i) {
@@ -84,6 +93,7 @@ private:
 #else
 	char map8_[256] __attribute__((aligned(16)));
 #endif
+	uint8_t seed_map_[256];
 	unsigned size_;
 
 };
@@ -92,8 +92,11 @@ struct sequence
 	}
 	friend Text_buffer& operator<<(Text_buffer &buf, const sequence &s)
 	{
-		for(unsigned i=0;i<s.len_;++i)
-			buf << value_traits.alphabet[(long)s.data_[i]];
+		buf.reserve(s.len_);
+		char *p = buf;
+		for(size_t i=0;i<s.len_;++i)
+			p[i] = value_traits.alphabet[(long)s.data_[i]];
+		buf += s.len_;
 		return buf;
 	}
 	/*friend std::ostream& operator<<(std::ostream &os, const sequence &s)
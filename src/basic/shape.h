@@ -88,28 +88,11 @@ struct shape
 	}
 
 	inline bool set_seed(Packed_seed &s, const Letter *seq) const
-	{
-		s = 0;
-#ifdef FREQUENCY_MASKING
-		double f = 0;
-#endif
-		for(unsigned i=0;i<weight_;++i) {
-			Letter l = seq[positions_[i]];
-			if(l == value_traits.mask_char|| l == '\xff')
-				return false;
-			l = mask_critical(l);
-			unsigned r = Reduction::reduction(l);
-#ifdef FREQUENCY_MASKING
-			f += background_freq[r];
-#endif
-			s *= Reduction::reduction.size();
-			s += uint64_t(r);
-		}
-#ifdef FREQUENCY_MASKING
-		if(use_seed_freq() && f > config.max_seed_freq) return false;
-#endif
-		return true;
-	}
+	{ return dispatch_seed<Letter_map>(s, seq); }
+
+	/* Computes the seed from a sequence mapped by reduce_seed_letters. */
+	inline bool set_seed_reduced(Packed_seed &s, const Letter *seq) const
+	{ return dispatch_seed<Reduced_map>(s, seq); }
 
 	inline bool	is_low_freq(const Letter *seq) const
 	{
@@ -156,6 +139,69 @@ struct shape
 
 	uint32_t length_, weight_, positions_[Const::max_seed_weight], d_, mask_, rev_mask_, id_;
 
+private:
+
+	struct Letter_map
+	{
+		static unsigned get(Letter l)
+		{ return Reduction::reduction.seed_letter(l); }
+	};
+
+	struct Reduced_map
+	{
+		static unsigned get(Letter l)
+		{ return (uint8_t)l; }
+	};
+
+	/* Instantiated for the seed weights of the built-in shape codes, so that
+	the loop over the seed positions is unrolled. */
+	template<typename _map>
+	inline bool dispatch_seed(Packed_seed &s, const Letter *seq) const
+	{
+		switch(weight_) {
+		case 9:
+			return seed<9,_map>(s, seq);
+		case 12:
+			return seed<12,_map>(s, seq);
+		default:
+			return seed<0,_map>(s, seq);
+		}
+	}
+
+	template<unsigned _w, typename _map>
+	inline bool seed(Packed_seed &s, const Letter *seq) const
+	{
+		const unsigned w = _w ? _w : weight_, size = Reduction::reduction.size();
+		s = 0;
+#ifdef FREQUENCY_MASKING
+		double f = 0;
+#endif
+		for(unsigned i=0;i<w;++i) {
+			const unsigned r = _map::get(seq[positions_[i]]);
+			if(r == 0xff)
+				return false;
+#ifdef FREQUENCY_MASKING
+			f += background_freq[r];
+#endif
+			s *= size;
+			s += uint64_t(r);
+		}
+#ifdef FREQUENCY_MASKING
+		if(use_seed_freq() && f > config.max_seed_freq) return false;
+#endif
+		return true;
+	}
+
 };
 
+/* Maps the letters of a sequence to reduced seed letters once, so that the
+seeds of all positions and shapes can be computed by set_seed_reduced. */
+inline const Letter* reduce_seed_letters(const Letter *seq, size_t len, vector<Letter> &buf)
+{
+	buf.resize(len);
+	for(size_t i=0;i<len;++i)
+		buf[i] = (Letter)Reduction::reduction.seed_letter(seq[i]);
+	return buf.data();
+}
+
 #endif /* SHAPE_H_ */
@@ -23,6 +23,8 @@ LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR P
 #include <algorithm>
 #include <vector>
 #include "../basic/value.h"
+#include "../util/simd_hash_table.h"
+#include "../util/hash_function.h"
 
 using std::vector;
 using std::auto_ptr;
@@ -43,29 +45,44 @@ struct Masked_sequence_set : public Sequence_set
 
 		timer.finish();
 		size_t n = 0;
-		for(size_t i=range.begin();i<range.end();++i) {
+		for(size_t i=range.begin();i<range.end();++i)
 			n += counts[i];
-			const size_t ht_size (std::max(static_cast<size_t>(static_cast<float>(counts[i]) * 1.3), static_cast<size_t>(counts[i] + 1)));
-			pos_filters[sid][i] = auto_ptr<filter_table> (new filter_table(ht_size));
-		}
 		log_stream << "Hit cap = " << config.hit_cap << std::endl;
 		log_stream << "Low complexity seeds = " << n << std::endl;
 
 		timer.go("Building position filter");
-		Build_context build_context(idx, sid, counts, *this);
+		vector<vector<Filter_entry> > entries (Const::seedp);
+		Build_context build_context(idx, sid, counts, entries, *this);
 		launch_scheduled_thread_pool(build_context, Const::seedp, config.threads_);
+		filter_table &filter = pos_filters[sid];
+		if(range.begin() == 0)
+			filter.clear();
+		filter.reserve(n);
+		for(size_t i=range.begin();i<range.end();++i)
+			for(vector<Filter_entry>::const_iterator j=entries[i].begin();j!=entries[i].end();++j)
+				filter.insert(j->first, j->second);
 		timer.finish();
 		log_stream << "Masked positions = " << std::accumulate(counts.begin(), counts.end(), 0) << std::endl;
 	}
 
+	/* Removes the masking of a previous search so that the sequences can be
+	indexed again for another query chunk. */
+	void clear_masking()
+	{
+		Letter *p = this->data(0), *end = p + this->raw_len();
+		for(;p < end;++p)
+			if(*p != '\xff')
+				*p = mask_critical(*p);
+	}
+
 	bool get_masking(const Letter *pos, unsigned sid) const
 	{
 		Packed_seed seed;
 		shapes.get_shape(sid).set_seed(seed, pos);
-		const filter_table::entry *e;
-		if((e = pos_filters[sid][seed_partition(seed)]->operator [](seed_partition_offset(seed))) != 0) {
+		const uint8_t *treshold;
+		if((treshold = pos_filters[sid].find(seed)) != 0) {
 			const size_t offset (pos - this->data(0));
-			return !position_filter(offset, e->value, seed_partition_offset(seed));
+			return !position_filter(offset, *treshold, seed_partition_offset(seed));
 		}
 		return false;
 	}
@@ -96,21 +113,25 @@ private:
 		vector<unsigned> &counts;
 	};
 
+	typedef pair<Packed_seed,uint8_t> Filter_entry;
+
 	struct Build_context
 	{
-		Build_context(const sorted_list &idx, unsigned sid, vector<unsigned> &counts, Masked_sequence_set &seqs):
+		Build_context(const sorted_list &idx, unsigned sid, vector<unsigned> &counts, vector<vector<Filter_entry> > &entries, Masked_sequence_set &seqs):
 			idx (idx),
 			sid (sid),
 			counts (counts),
+			entries (entries),
 			seqs (seqs)
 		{ }
 		void operator()(unsigned thread_id, unsigned seedp)
 		{
 			unsigned n = 0;
+			entries[seedp].reserve(counts[seedp]);
 			sorted_list::iterator i = idx.get_partition_begin(seedp);
 			while(!i.at_end()) {
 				if(i.n > config.hit_cap)
-					n += seqs.mask_seed_pos(i, sid, seedp);
+					n += seqs.mask_seed_pos(i, seedp, entries[seedp]);
 				++i;
 			}
 			counts[seedp] = n;
@@ -118,10 +139,11 @@ private:
 		const sorted_list &idx;
 		const unsigned sid;
 		vector<unsigned> &counts;
+		vector<vector<Filter_entry> > &entries;
 		Masked_sequence_set &seqs;
 	};
 
-	unsigned mask_seed_pos(sorted_list::iterator &i, unsigned sid, unsigned p)
+	unsigned mask_seed_pos(sorted_list::iterator &i, unsigned p, vector<Filter_entry> &entries)
 	{
 		const unsigned treshold (filter_treshold((unsigned)i.n));
 		unsigned count (0), k (0);
@@ -130,9 +152,11 @@ private:
 				mask_seed_pos(i[j]);
 				++count;
 			} else
-				*(i.get(k++)) = *(i.get(j));
-		i.get(k)->value = 0;
-		pos_filters[sid][p]->insert(i.key(), treshold);
+				i.set(k++, i[j]);
+		if(k < i.n)
+			i.set(k, 0);
+		if(treshold > 0)
+			entries.push_back(Filter_entry (((Packed_seed)i.key() << Const::seedp_bits) | p, (uint8_t)treshold));
 		return count;
 	}
 
@@ -144,8 +168,10 @@ private:
 
 private:
 
-	typedef hash_table<uint32_t, uint8_t, value_compare<uint8_t, 0>, murmur_hash> filter_table;
-	auto_ptr<filter_table> pos_filters[Const::max_shapes][Const::seedp];
+	/* One table per shape, keyed by the seed, holding the position filter
+	treshold of each low complexity seed. */
+	typedef Simd_hash_table<Packed_seed, uint8_t, murmur_hash> filter_table;
+	filter_table pos_filters[Const::max_shapes];
 
 };
 
@@ -17,9 +17,15 @@ LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR P
 ****/
 
 #include "queries.h"
+#include "query_dedup.h"
+#include "result_cache.h"
 
 unsigned current_query_chunk;
+size_t current_query_offset = 0;
 Sequence_set* query_source_seqs::data_ = 0;
 Sequence_set* query_seqs::data_ = 0;
 String_set<0>* query_ids::data_ = 0;
-auto_ptr<seed_histogram> query_hst;
\ No newline at end of file
+auto_ptr<seed_histogram> query_hst;
+Query_dedup* Query_dedup::instance = 0;
+Result_cache* Result_cache::instance = 0;
+Cached_queries* Cached_queries::instance = 0;
\ No newline at end of file
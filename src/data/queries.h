@@ -29,6 +29,8 @@ Author: Benjamin Buchfink
 
 extern auto_ptr<seed_histogram> query_hst;
 extern unsigned current_query_chunk;
+// Number of queries in the query chunks before the current one.
+extern size_t current_query_offset;
 
 struct query_source_seqs
 {
@@ -0,0 +1,128 @@
+/****
+Copyright (c) 2016, University of Tuebingen, Benjamin Buchfink
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification, are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this list of conditions and the following disclaimer.
+
+2. Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the following disclaimer in the documentation and/or other materials provided with the distribution.
+
+3. Neither the name of the copyright holder nor the names of its contributors may be used to endorse or promote products derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+****/
+
+#ifndef QUERY_DEDUP_H_
+#define QUERY_DEDUP_H_
+
+#include <vector>
+#include <algorithm>
+#include <utility>
+#include "../basic/value.h"
+#include "queries.h"
+
+using std::vector;
+using std::pair;
+
+/* Exact duplicates among the queries of a chunk. The query sets are replaced
+by sets that hold only the first copy (the representative) of each sequence,
+so that duplicates are neither searched nor aligned. Before the output is
+joined, swap_sets() puts the full sets back, and join_blocks() repeats the
+records of each representative for its duplicates. Queries are compared by
+their search contexts, i.e. after translation and masking. */
+struct Query_dedup
+{
+
+	/* Replaces the current query sets if they contain duplicates. Returns 0
+	otherwise. */
+	static Query_dedup* build()
+	{
+		vector<unsigned> rep;
+		if (query_seqs::get().duplicates(align_mode.query_contexts, rep) == 0)
+			return 0;
+		return new Query_dedup (rep);
+	}
+
+	~Query_dedup()
+	{
+		delete seqs_;
+		delete source_seqs_;
+		delete ids_;
+	}
+
+	/* Exchanges the query sets of the search with the full ones. */
+	void swap_sets()
+	{
+		std::swap(seqs_, query_seqs::data_);
+		std::swap(source_seqs_, query_source_seqs::data_);
+		std::swap(ids_, query_ids::data_);
+	}
+
+	/* Original query number of a representative. */
+	unsigned original(unsigned rep) const
+	{ return original_[rep]; }
+
+	/* Duplicates (original query number, representative) in query order. */
+	const vector<pair<unsigned, unsigned> >& duplicates() const
+	{ return duplicates_; }
+
+	/* Number of representatives. */
+	unsigned size() const
+	{ return (unsigned)original_.size(); }
+
+	/* Number of duplicates of a representative. */
+	unsigned copies(unsigned rep) const
+	{ return copies_[rep]; }
+
+	static Query_dedup *instance;
+
+private:
+
+	Query_dedup(const vector<unsigned> &rep):
+		seqs_ (new Sequence_set),
+		source_seqs_ (new Sequence_set),
+		ids_ (new String_set<0>)
+	{
+		const unsigned contexts = align_mode.query_contexts;
+		vector<unsigned> rep_id (rep.size());
+		vector<Letter> seq;
+		for (unsigned i = 0; i < rep.size(); ++i) {
+			if (rep[i] != i) {
+				duplicates_.push_back(std::make_pair(i, rep_id[rep[i]]));
+				++copies_[rep_id[rep[i]]];
+				continue;
+			}
+			rep_id[i] = (unsigned)original_.size();
+			original_.push_back(i);
+			copies_.push_back(0);
+			for (unsigned j = 0; j < contexts; ++j)
+				push(*seqs_, query_seqs::get()[i*contexts + j], seq);
+			if (align_mode.query_translated)
+				push(*source_seqs_, query_source_seqs::get()[i], seq);
+			push(*ids_, query_ids::get()[i], seq);
+		}
+		seqs_->finish_reserve();
+		source_seqs_->finish_reserve();
+		ids_->finish_reserve();
+		swap_sets();
+	}
+
+	template<typename _set>
+	static void push(_set &set, const sequence &s, vector<Letter> &v)
+	{
+		v.assign(s.data(), s.data() + s.length());
+		set.push_back(v);
+	}
+
+	Sequence_set *seqs_, *source_seqs_;
+	String_set<0> *ids_;
+	vector<unsigned> original_, copies_;
+	vector<pair<unsigned, unsigned> > duplicates_;
+
+};
+
+#endif /* QUERY_DEDUP_H_ */
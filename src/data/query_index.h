@@ -0,0 +1,129 @@
+/****
+Copyright (c) 2016, University of Tuebingen, Benjamin Buchfink
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification, are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this list of conditions and the following disclaimer.
+
+2. Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the following disclaimer in the documentation and/or other materials provided with the distribution.
+
+3. Neither the name of the copyright holder nor the names of its contributors may be used to endorse or promote products derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+****/
+#ifndef QUERY_INDEX_H_
+#define QUERY_INDEX_H_
+
+#include <vector>
+#include <algorithm>
+#include "../basic/config.h"
+#include "../basic/shape_config.h"
+#include "sorted_list.h"
+#include "seed_histogram.h"
+#include "queries.h"
+#include "../search/index_fps.h"
+
+using std::vector;
+
+/* Keeps the query seed indexes of all shapes and index chunks resident for
+the lifetime of a query chunk, so that they are built only once instead of
+once per reference block. The indexes of all shapes of an index chunk are
+built together on first use, in a single scan over the queries. The
+fingerprints of the query positions are kept along with them. */
+struct Query_index_cache
+{
+
+	Query_index_cache(const seed_histogram &hst):
+		hst_ (hst),
+		parts_ (Const::seedp, config.lowmem),
+		idx_ (shapes.count()*parts_.parts),
+		buffer_ (shapes.count()*parts_.parts),
+		fps_ (shapes.count()*parts_.parts)
+	{ }
+
+	~Query_index_cache()
+	{
+		for(unsigned i=0;i<idx_.size();++i) {
+			delete fps_[i];
+			delete idx_[i];
+			delete[] buffer_[i];
+		}
+	}
+
+	/* Peak size in bytes of the indexes of all shapes and chunks. In CSR
+	layout, the lists of all shapes of a chunk are built with full entries
+	before they are shrunk one by one, and the key directory holds at most
+	one entry per seed plus a sentinel per partition. */
+	static size_t mem_size(const seed_histogram &hst)
+	{
+		const ::partition<unsigned> p (Const::seedp, config.lowmem);
+		size_t resident = 0, build_peak = 0;
+		for(unsigned chunk=0;chunk<p.parts;++chunk) {
+			const seedp_range range (p.getMin(chunk), p.getMax(chunk));
+			size_t build = 0, shrink = 0;
+			for(unsigned sid=0;sid<shapes.count();++sid) {
+				const size_t n = hst_size(hst.get(config.index_mode, sid), range);
+				resident += n * sizeof(Finger_print);
+				if(config.csr_index) {
+					resident += n * (sizeof(sorted_list::_pos) + sizeof(sorted_list::Key_entry)) + Const::seedp * sizeof(sorted_list::Key_entry);
+					build += n * sizeof(sorted_list::entry);
+					shrink = std::max(shrink, n * sizeof(sorted_list::_pos));
+				} else
+					resident += n * sizeof(sorted_list::entry);
+			}
+			build_peak = std::max(build_peak, build + shrink);
+		}
+		return resident + build_peak;
+	}
+
+	static size_t budget()
+	{ return (size_t)(config.query_index_cache * 1e9); }
+
+	static bool fits(const seed_histogram &hst, size_t budget = Query_index_cache::budget())
+	{ return config.query_index_cache > 0 && mem_size(hst) <= budget; }
+
+	const sorted_list& get(unsigned sid, unsigned chunk)
+	{
+		if(idx_[sid*parts_.parts + chunk] == 0) {
+			const seedp_range range (parts_.getMin(chunk), parts_.getMax(chunk));
+			vector<char*> buffers;
+			for(unsigned k=0;k<shapes.count();++k) {
+				buffers.push_back(new char[sizeof(sorted_list::entry) * hst_size(hst_.get(config.index_mode, k), range)]);
+				buffer_[k*parts_.parts + chunk] = buffers.back();
+			}
+			const vector<sorted_list*> lists (sorted_list::build_all(buffers, *query_seqs::data_, hst_, range));
+			for(unsigned k=0;k<shapes.count();++k) {
+				idx_[k*parts_.parts + chunk] = lists[k];
+				if(config.csr_index) {
+					char *buffer = lists[k]->shrink();
+					delete[] buffer_[k*parts_.parts + chunk];
+					buffer_[k*parts_.parts + chunk] = buffer;
+				}
+			}
+		}
+		return *idx_[sid*parts_.parts + chunk];
+	}
+
+	const Index_fps& get_fps(unsigned sid, unsigned chunk)
+	{
+		const unsigned i = sid*parts_.parts + chunk;
+		if(fps_[i] == 0)
+			fps_[i] = new Index_fps (get(sid, chunk), *query_seqs::data_);
+		return *fps_[i];
+	}
+
+private:
+
+	const seed_histogram &hst_;
+	const ::partition<unsigned> parts_;
+	vector<sorted_list*> idx_;
+	vector<char*> buffer_;
+	vector<Index_fps*> fps_;
+
+};
+
+#endif /* QUERY_INDEX_H_ */
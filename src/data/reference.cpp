@@ -19,6 +19,7 @@ LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR P
 #include "reference.h"
 
 String_set<0>* ref_ids::data_ = 0;
+Ref_clusters* ref_clusters::data_ = 0;
 Ref_map ref_map;
 seed_histogram ref_hst;
 unsigned current_ref_block;
@@ -23,6 +23,7 @@ Author: Benjamin Buchfink
 
 #include <memory>
 #include <string>
+#include <map>
 #include <numeric>
 #include <limits>
 #include "../util/binary_file.h"
@@ -52,13 +53,18 @@ struct Reference_header
 		unique_id (0x24af8a415ee186dllu),
 		build (Const::build_version),
 		long_addressing (false),
+		clustered (false),
+		digest (0),
 		sequences (0),
 		letters (0)
 	{ }
 	uint64_t unique_id;
 	uint32_t build;
-	bool long_addressing;
+	bool long_addressing, clustered;
 	unsigned n_blocks;
+	/* Hash of the sequences and titles, 0 for databases built without it.
+	Occupies what used to be padding, so the header layout is unchanged. */
+	uint32_t digest;
 	size_t sequences, letters;
 	double block_size;
 #ifdef EXTRA
@@ -83,8 +89,10 @@ struct Database_file : public Input_stream
 			throw Database_format_exception ();
 		if(ref_header.unique_id != Reference_header ().unique_id)
 			throw Database_format_exception ();
-		if(ref_header.build > Const::build_version || ref_header.build < Const::build_compatibility)
+		if(ref_header.build > Const::cluster_build || ref_header.build < Const::build_compatibility)
 			throw invalid_database_version_exception();
+		if(ref_header.build < Const::cluster_build)
+			ref_header.clustered = false;
 #ifdef EXTRA
 		if(sequence_type(_val()) != ref_header.sequence_type)
 			throw std::runtime_error("Database has incorrect sequence type for current alignment mode.");
@@ -110,6 +118,35 @@ struct ref_ids
 	static String_set<0> *data_;
 };
 
+/* Cluster members of a reference block of a clustered database. The members
+are stored after the representatives and are not indexed; the members of
+representative i are the sequences [begin[i], begin[i+1]). */
+struct Ref_clusters
+{
+	Ref_clusters()
+	{ }
+	Ref_clusters(Input_stream &file)
+	{ file.read(begin_); }
+	void save(Output_stream &file) const
+	{ file.write(begin_); }
+	size_t representatives() const
+	{ return begin_.size() - 1; }
+	bool has_members(size_t i) const
+	{ return i < representatives() && begin_[i] < begin_[i+1]; }
+	unsigned member_begin(size_t i) const
+	{ return begin_[i]; }
+	unsigned member_end(size_t i) const
+	{ return begin_[i+1]; }
+	vector<uint32_t> begin_;
+};
+
+struct ref_clusters
+{
+	static const Ref_clusters& get()
+	{ return *data_; }
+	static Ref_clusters *data_;
+};
+
 extern seed_histogram ref_hst;
 extern unsigned current_ref_block;
 
@@ -146,17 +183,25 @@ struct Ref_map
 				mtx_.unlock();
 				return n;
 			}
-			n = next_++;
+			n = add(config.salltitles ? new string(ref_ids::get()[i].c_str()) : get_str(ref_ids::get()[i].c_str(), Const::id_delimiters),
+				(uint32_t)ref_seqs::get().length(i));
 			data_[block][i] = n;
-			len_.push_back((uint32_t)ref_seqs::get().length(i));
-			if (config.salltitles)
-				name_.push_back(new string(ref_ids::get()[i].c_str()));
-			else
-				name_.push_back(get_str(ref_ids::get()[i].c_str(), Const::id_delimiters));
 			mtx_.unlock();
 		}
 		return n;
 	}
+	/* Id of a subject known only by its name, as for cached results. */
+	uint32_t get(const string &name, uint32_t length)
+	{
+		mtx_.lock();
+		const uint32_t n = add(new string(name), length);
+		mtx_.unlock();
+		return n;
+	}
+	const char* name(uint32_t i) const
+	{ return name_[i].c_str(); }
+	uint32_t length(uint32_t i) const
+	{ return len_[i]; }
 	/*template<typename _val>
 	void finish()
 	{
@@ -173,10 +218,29 @@ struct Ref_map
 		}
 	}*/
 private:
+	/* Assigns an id to a subject, taking ownership of the name. With a result
+	cache, subjects are also looked up by name and length, so that a subject
+	found both in the cache and in the search gets a single id. */
+	uint32_t add(string *name, uint32_t length)
+	{
+		if(!config.result_cache.empty()) {
+			const pair<string,uint32_t> key (*name, length);
+			const std::map<pair<string,uint32_t>,uint32_t>::const_iterator i = by_name_.find(key);
+			if(i != by_name_.end()) {
+				delete name;
+				return i->second;
+			}
+			by_name_[key] = next_;
+		}
+		len_.push_back(length);
+		name_.push_back(name);
+		return next_++;
+	}
 	tthread::mutex mtx_;
 	vector<vector<uint32_t> > data_;
 	vector<uint32_t> len_;
 	Ptr_vector<string> name_;
+	std::map<pair<string,uint32_t>,uint32_t> by_name_;
 	uint32_t next_;
 	friend struct DAA_output;
 };
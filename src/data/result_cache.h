@@ -0,0 +1,297 @@
+/****
+Copyright (c) 2016, University of Tuebingen, Benjamin Buchfink
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification, are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this list of conditions and the following disclaimer.
+
+2. Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the following disclaimer in the documentation and/or other materials provided with the distribution.
+
+3. Neither the name of the copyright holder nor the names of its contributors may be used to endorse or promote products derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+****/
+
+#ifndef RESULT_CACHE_H_
+#define RESULT_CACHE_H_
+
+#include <stdio.h>
+#include <vector>
+#include <map>
+#include <string>
+#include <sstream>
+#include <utility>
+#include "../basic/config.h"
+#include "../basic/value.h"
+#include "../util/binary_file.h"
+#include "../util/binary_buffer.h"
+#include "../util/hash_function.h"
+#include "reference.h"
+#include "queries.h"
+
+using std::vector;
+using std::pair;
+using std::string;
+
+/* Output records of earlier searches, stored on disk per query sequence. One
+file of the cache directory holds the results for one combination of
+database and search parameters. An entry consists of the query contexts and
+an opaque record payload that is written by join_blocks(). */
+struct Result_cache
+{
+
+	/* Must be constructed before the search has adjusted the options. */
+	Result_cache(const string &dir):
+		params_ (params()),
+		file_name_ (dir + '/' + hex(params_) + ".rcache"),
+		loaded_ (0)
+	{
+		Header h (0);
+		try {
+			Input_stream in (file_name_);
+			if(in.read(&h, 1) == 1 && h.magic == Header(params_).magic && h.params == params_)
+				in.read(data_);
+			in.close();
+		} catch(File_open_exception&) {
+		}
+		for(size_t i = 0; i < data_.size(); i = next(i))
+			index_.insert(std::make_pair(entry(i).hash, i));
+		loaded_ = index_.size();
+	}
+
+	/* Looks up the current query with the given number. Returns the offset of
+	its entry or npos. */
+	size_t find(unsigned query) const
+	{
+		const vector<Letter> &seq = contexts(query);
+		const uint64_t h = hash(seq);
+		for(std::multimap<uint64_t,size_t>::const_iterator i = index_.lower_bound(h); i != index_.end() && i->first == h; ++i) {
+			const Entry &e = entry(i->second);
+			if(e.seq_len == seq.size() && std::equal(seq.begin(), seq.end(), &data_[i->second + sizeof(Entry)]))
+				return i->second;
+		}
+		return npos;
+	}
+
+	/* Stores the payload for the current query with the given number. */
+	void insert(unsigned query, const char *payload, size_t size)
+	{
+		if(find(query) != npos)
+			return;
+		const vector<Letter> &seq = contexts(query);
+		Entry e;
+		e.hash = hash(seq);
+		e.seq_len = (uint32_t)seq.size();
+		e.size = (uint32_t)size;
+		const size_t offset = data_.size();
+		data_.insert(data_.end(), (const char*)&e, (const char*)(&e + 1));
+		data_.insert(data_.end(), seq.begin(), seq.end());
+		data_.insert(data_.end(), payload, payload + size);
+		index_.insert(std::make_pair(e.hash, offset));
+	}
+
+	Binary_buffer::Iterator payload(size_t offset) const
+	{
+		const vector<char>::const_iterator begin = data_.begin() + offset + sizeof(Entry) + entry(offset).seq_len;
+		return Binary_buffer::Iterator (begin, begin + entry(offset).size);
+	}
+
+	/* Writes the cache file if entries were added. The file is replaced by
+	renaming so that concurrent readers see either version. */
+	void save() const
+	{
+		if(index_.size() == loaded_)
+			return;
+		const string tmp = file_name_ + ".tmp";
+		Output_stream out (tmp);
+		const Header h (params_);
+		out.typed_write(&h, 1);
+		out.write(data_);
+		out.close();
+		if(rename(tmp.c_str(), file_name_.c_str()) != 0)
+			throw std::runtime_error("Error writing result cache " + file_name_);
+	}
+
+	size_t size() const
+	{ return index_.size(); }
+
+	static const size_t npos = (size_t)-1;
+	static Result_cache *instance;
+
+private:
+
+	struct Header
+	{
+		Header(uint64_t params):
+			magic (0x31455441434c5352llu),
+			params (params)
+		{ }
+		uint64_t magic, params;
+	};
+
+	struct Entry
+	{
+		uint64_t hash;
+		uint32_t seq_len, size;
+	};
+
+	/* Hash of the database and the options that affect the search results.
+	The database is identified by the content digest written by makedb
+	together with its header fields. Databases built before the digest was
+	added can only be told apart by the header fields. */
+	static uint64_t params()
+	{
+		std::stringstream ss;
+		ss << ref_header.digest << ' ' << ref_header.build << ' ' << ref_header.sequences << ' ' << ref_header.letters << ' ' << ref_header.n_blocks << ' '
+			<< ref_header.block_size << ' ' << ref_header.clustered << ' ' << config.command << ' ' << config.db_size << ' '
+			<< config.matrix << ' ' << config.gap_open << ' ' << config.gap_extend << ' ' << config.seg << ' '
+			<< config.max_evalue << ' ' << config.min_bit_score << ' ' << config.max_alignments << ' ' << config.toppercent << ' '
+			<< config.min_id << ' ' << config.query_cover << ' ' << config.mode_sensitive << ' ' << config.salltitles << ' '
+			<< config.single_domain << ' ' << config.max_seed_freq << ' ' << config.run_len << ' ' << config.hit_cap << ' '
+			<< config.min_identities << ' ' << config.window << ' ' << config.xdrop << ' ' << config.gapped_xdrop << ' '
+			<< config.min_ungapped_raw_score << ' ' << config.hit_band << ' ' << config.min_hit_score << ' ' << config.padding << ' '
+			<< config.shapes << ' ' << config.index_mode << ' ' << config.rank_factor << ' ' << config.rank_ratio << ' '
+			<< config.local_align_mode << ' ' << config.diagonal_cache << ' ' << config.shape_early_stop << ' ' << config.cluster_expand;
+		const string s = ss.str();
+		return hash(vector<Letter> (s.begin(), s.end()));
+	}
+
+	static uint64_t hash(const vector<Letter> &v)
+	{
+		uint64_t h = 0xcbf29ce484222325llu;
+		for(vector<Letter>::const_iterator i = v.begin(); i != v.end(); ++i)
+			h = (h ^ (uint8_t)*i) * 0x100000001b3llu;
+		return murmur_hash()(h ^ v.size());
+	}
+
+	static string hex(uint64_t x)
+	{
+		char s[17];
+		sprintf(s, "%016llx", (unsigned long long)x);
+		return s;
+	}
+
+	/* The search contexts of a query, separated by delimiters. */
+	static const vector<Letter>& contexts(unsigned query)
+	{
+		static vector<Letter> v;
+		const unsigned n = align_mode.query_contexts;
+		v.clear();
+		for(unsigned i = 0; i < n; ++i) {
+			const sequence s = query_seqs::get()[query*n + i];
+			v.insert(v.end(), s.data(), s.data() + s.length());
+			v.push_back(Letter(0xff));
+		}
+		return v;
+	}
+
+	const Entry& entry(size_t offset) const
+	{ return *(const Entry*)&data_[offset]; }
+
+	size_t next(size_t offset) const
+	{ return offset + sizeof(Entry) + entry(offset).seq_len + entry(offset).size; }
+
+	const uint64_t params_;
+	const string file_name_;
+	vector<char> data_;
+	std::multimap<uint64_t,size_t> index_;
+	size_t loaded_;
+
+};
+
+/* Queries of a chunk found in the result cache. Like Query_dedup, the query
+sets are replaced by sets that hold only the remaining queries, and
+swap_sets() puts the full sets back before the output is joined. */
+struct Cached_queries
+{
+
+	/* Replaces the current query sets if some queries are cached. Returns 0
+	otherwise. */
+	static Cached_queries* build(const Result_cache &cache)
+	{
+		vector<size_t> entry;
+		size_t n = 0;
+		for(unsigned i = 0; i < query_ids::get().get_length(); ++i) {
+			entry.push_back(cache.find(i));
+			if(entry.back() != Result_cache::npos)
+				++n;
+		}
+		if(n == 0)
+			return 0;
+		return new Cached_queries (entry);
+	}
+
+	~Cached_queries()
+	{
+		delete seqs_;
+		delete source_seqs_;
+		delete ids_;
+	}
+
+	void swap_sets()
+	{
+		std::swap(seqs_, query_seqs::data_);
+		std::swap(source_seqs_, query_source_seqs::data_);
+		std::swap(ids_, query_ids::data_);
+	}
+
+	/* Original query number of a searched query. */
+	unsigned original(unsigned query) const
+	{ return original_[query]; }
+
+	/* Number of searched queries. */
+	unsigned searched() const
+	{ return (unsigned)original_.size(); }
+
+	/* Cached queries (original query number, cache entry) in query order. */
+	const vector<pair<unsigned, size_t> >& hits() const
+	{ return hits_; }
+
+	static Cached_queries *instance;
+
+private:
+
+	Cached_queries(const vector<size_t> &entry):
+		seqs_ (new Sequence_set),
+		source_seqs_ (new Sequence_set),
+		ids_ (new String_set<0>)
+	{
+		const unsigned contexts = align_mode.query_contexts;
+		vector<Letter> seq;
+		for (unsigned i = 0; i < entry.size(); ++i) {
+			if (entry[i] != Result_cache::npos) {
+				hits_.push_back(std::make_pair(i, entry[i]));
+				continue;
+			}
+			original_.push_back(i);
+			for (unsigned j = 0; j < contexts; ++j)
+				push(*seqs_, query_seqs::get()[i*contexts + j], seq);
+			if (align_mode.query_translated)
+				push(*source_seqs_, query_source_seqs::get()[i], seq);
+			push(*ids_, query_ids::get()[i], seq);
+		}
+		seqs_->finish_reserve();
+		source_seqs_->finish_reserve();
+		ids_->finish_reserve();
+		swap_sets();
+	}
+
+	template<typename _set>
+	static void push(_set &set, const sequence &s, vector<Letter> &v)
+	{
+		v.assign(s.data(), s.data() + s.length());
+		set.push_back(v);
+	}
+
+	Sequence_set *seqs_, *source_seqs_;
+	String_set<0> *ids_;
+	vector<unsigned> original_;
+	vector<pair<unsigned, size_t> > hits_;
+
+};
+
+#endif /* RESULT_CACHE_H_ */
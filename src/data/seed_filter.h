@@ -0,0 +1,97 @@
+/****
+Copyright (c) 2016, University of Tuebingen, Benjamin Buchfink
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification, are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this list of conditions and the following disclaimer.
+
+2. Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the following disclaimer in the documentation and/or other materials provided with the distribution.
+
+3. Neither the name of the copyright holder nor the names of its contributors may be used to endorse or promote products derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+****/
+
+#ifndef SEED_FILTER_H_
+#define SEED_FILTER_H_
+
+#include <vector>
+#include <stdint.h>
+#include "../basic/const.h"
+#include "../basic/config.h"
+#include "../util/hash_function.h"
+#include "../util/thread.h"
+#include "../util/log_stream.h"
+
+using std::vector;
+
+/* Approximate membership filter over the seeds of an index. One bit array
+per seed partition is addressed by a hash of the partition offset of the
+seed, using 16 bits per distinct key. Used to skip reference seeds that
+cannot match any query seed. */
+struct Seed_filter
+{
+
+	template<typename _idx>
+	Seed_filter(const _idx &idx)
+	{
+		task_timer timer ("Building seed filter", 3);
+		Build_context<_idx> context (idx, *this);
+		launch_scheduled_thread_pool(context, Const::seedp, config.threads_);
+	}
+
+	bool contains(unsigned p, unsigned key) const
+	{
+		const vector<uint64_t> &bits = bits_[p];
+		if(bits.empty())
+			return false;
+		const uint64_t h = murmur_hash()(key) & mask_[p];
+		return (bits[h >> 6] & (uint64_t(1) << (h & 63))) != 0;
+	}
+
+private:
+
+	template<typename _idx>
+	struct Build_context
+	{
+		Build_context(const _idx &idx, Seed_filter &filter):
+			idx (idx),
+			filter (filter)
+		{ }
+		void operator()(unsigned thread_id, unsigned seedp) const
+		{ filter.build_partition(idx, seedp); }
+		const _idx &idx;
+		Seed_filter &filter;
+	};
+
+	template<typename _idx>
+	void build_partition(const _idx &idx, unsigned p)
+	{
+		size_t keys = 0;
+		for(typename _idx::const_iterator i = idx.get_partition_cbegin(p); !i.at_end(); ++i)
+			++keys;
+		if(keys == 0)
+			return;
+		size_t size = 64;
+		while(size < keys * bits_per_key)
+			size <<= 1;
+		mask_[p] = size - 1;
+		bits_[p].resize(size / 64);
+		for(typename _idx::const_iterator i = idx.get_partition_cbegin(p); !i.at_end(); ++i) {
+			const uint64_t h = murmur_hash()(i.key()) & mask_[p];
+			bits_[p][h >> 6] |= uint64_t(1) << (h & 63);
+		}
+	}
+
+	enum { bits_per_key = 16 };
+
+	vector<uint64_t> bits_[Const::seedp];
+	uint64_t mask_[Const::seedp];
+
+};
+
+#endif /* SEED_FILTER_H_ */
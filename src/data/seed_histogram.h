@@ -173,17 +173,19 @@ private:
 	{
 		assert(seqp < Const::seqp);
 		uint64_t key;
+		vector<Letter> buf;
 		for(size_t i=begin;i<end;++i) {
 
 			assert(i < seqs.get_length());
 			const sequence seq = seqs[i];
 			if(seq.length() < Const::min_shape_len) continue;
+			const Letter *r = reduce_seed_letters(&seq[0], seq.length(), buf);
 			for(unsigned j=0;j<seq.length()+1-Const::min_shape_len; ++j)
 				for(vector<shape_config>::const_iterator cfg = cfgs.begin(); cfg != cfgs.end(); ++cfg) {
 					assert(cfg->mode() < Const::index_modes);
 					assert(cfg->count() <= Const::max_shapes);
 					for(unsigned k=0;k<cfg->count(); ++k)
-						if(j+cfg->get_shape(k).length_ < seq.length()+1 && cfg->get_shape(k).set_seed(key, &seq[j]))
+						if(j+cfg->get_shape(k).length_ < seq.length()+1 && cfg->get_shape(k).set_seed_reduced(key, &r[j]))
 							++data_[cfg->mode()][k][seqp][seed_partition(key)];
 				}
 
@@ -24,7 +24,10 @@ Author: Benjamin Buchfink
 #include <iostream>
 #include <string>
 #include <algorithm>
+#include <string.h>
+#include <limits>
 #include "../basic/sequence.h"
+#include "../util/hash_function.h"
 #include "string_set.h"
 
 using std::cout;
@@ -34,13 +37,22 @@ using std::pair;
 struct Sequence_set : public String_set<'\xff',1>
 {
 
-	Sequence_set()
+	Sequence_set():
+		indexed_ (std::numeric_limits<size_t>::max())
 	{ }
 
 	Sequence_set(Input_stream &file):
-		String_set (file)
+		String_set (file),
+		indexed_ (std::numeric_limits<size_t>::max())
 	{ }
 
+	/* Restricts seed indexing to the first n sequences. */
+	void set_indexed(size_t n)
+	{ indexed_ = n; }
+
+	size_t indexed() const
+	{ return std::min(indexed_, this->get_length()); }
+
 	void print_stats() const
 	{ verbose_stream << "Sequences = " << this->get_length() << ", letters = " << this->letters() << ", average length = " << this->avg_len() << endl; }
 
@@ -90,16 +102,18 @@ struct Sequence_set : public String_set<'\xff',1>
 	vector<size_t> partition() const
 	{
 		vector<size_t> v;
-		const size_t l = (this->letters()+Const::seqp-1) / Const::seqp;
+		const size_t count = indexed(),
+			letters = this->position(count, 0) - this->position(0, 0) - count,
+			l = (letters+Const::seqp-1) / Const::seqp;
 		v.push_back(0);
-		for(unsigned i=0;i<this->get_length();) {
+		for(unsigned i=0;i<count;) {
 			size_t n = 0;
-			while(i<this->get_length() && n < l)
+			while(i<count && n < l)
 				n += this->length(i++);
 			v.push_back(i);
 		}
 		for(size_t i=v.size();i<Const::seqp+1;++i)
-			v.push_back(this->get_length());
+			v.push_back(count);
 		return v;
 	}
 
@@ -120,9 +134,73 @@ struct Sequence_set : public String_set<'\xff',1>
 		return this->letters() / this->get_length();
 	}
 
+	/* Finds entries that are identical to an earlier one, an entry being a
+	group of contexts consecutive sequences. Sets rep[i] to the first copy of
+	entry i and returns the number of duplicates. */
+	size_t duplicates(unsigned contexts, vector<unsigned> &rep) const
+	{
+		const size_t n = this->get_length() / contexts;
+		vector<pair<uint64_t, unsigned> > hashes (n);
+		for (size_t i = 0; i < n; ++i)
+			hashes[i] = std::make_pair(hash(i, contexts), (unsigned)i);
+		std::sort(hashes.begin(), hashes.end());
+
+		rep.resize(n);
+		for (size_t i = 0; i < n; ++i)
+			rep[i] = (unsigned)i;
+		size_t dups = 0;
+		for (size_t i = 0; i < n;) {
+			size_t j = i + 1;
+			while (j < n && hashes[j].first == hashes[i].first)
+				++j;
+			for (size_t k = i + 1; k < j; ++k)
+				for (size_t l = i; l < k; ++l)
+					if (rep[hashes[l].second] == hashes[l].second && equal(hashes[l].second, hashes[k].second, contexts)) {
+						rep[hashes[k].second] = hashes[l].second;
+						++dups;
+						break;
+					}
+			i = j;
+		}
+		return dups;
+	}
+
 	virtual ~Sequence_set()
 	{ }
 
+private:
+
+	uint64_t hash(size_t i, unsigned contexts) const
+	{
+		uint64_t h = 0;
+		for (unsigned j = 0; j < contexts; ++j) {
+			const sequence s = (*this)[i*contexts + j];
+			const char *p = (const char*)s.data(), *end = p + s.length();
+			h = murmur_hash()(h ^ s.length());
+			uint64_t x;
+			for (; p + sizeof(x) <= end; p += sizeof(x)) {
+				memcpy(&x, p, sizeof(x));
+				h = murmur_hash()(h ^ x);
+			}
+			x = 0;
+			memcpy(&x, p, end - p);
+			h = murmur_hash()(h ^ x);
+		}
+		return h;
+	}
+
+	bool equal(size_t a, size_t b, unsigned contexts) const
+	{
+		for (unsigned j = 0; j < contexts; ++j) {
+			const sequence s = (*this)[a*contexts + j], t = (*this)[b*contexts + j];
+			if (s.length() != t.length() || memcmp(s.data(), t.data(), s.length()) != 0)
+				return false;
+		}
+		return true;
+	}
+
+	size_t indexed_;
+
 
 };
 
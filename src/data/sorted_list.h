@@ -25,6 +25,7 @@ Author: Benjamin Buchfink
 #include "seed_histogram.h"
 #include "../basic/packed_loc.h"
 #include "../util/system.h"
+#include "seed_filter.h"
 
 #pragma pack(1)
 
@@ -49,31 +50,141 @@ struct sorted_list
 		_pos		value;
 	} PACKED_ATTRIBUTE ;
 
+	/* Entry of the key directory of a partition in CSR layout. The positions
+	of a key are stored in the range [begin, next.begin) of the position array
+	of the partition. */
+	struct Key_entry
+	{
+		Key_entry(unsigned key, uint32_t begin):
+			key (key),
+			begin (begin)
+		{ }
+		unsigned	key;
+		uint32_t	begin;
+	};
+
 	static char* alloc_buffer(const seed_histogram &hst)
-	{ return new char[sizeof(entry) * hst.max_chunk_size()]; }
+	{
+		if(!config.csr_index)
+			return new char[sizeof(entry) * hst.max_chunk_size()];
+		size_t size = 0;
+		::partition<unsigned> p (Const::seedp, config.lowmem);
+		for(unsigned sid=0;sid<shapes.count();++sid)
+			for(unsigned chunk=0;chunk<p.parts;++chunk)
+				size = std::max(size, csr_buffer_size(hst.get(config.index_mode, sid), seedp_range(p.getMin(chunk), p.getMax(chunk))));
+		return new char[size];
+	}
+
+	static char* alloc_buffer(const shape_histogram &hst, const seedp_range &range)
+	{ return new char[config.csr_index ? csr_buffer_size(hst, range) : sizeof(entry) * hst_size(hst, range)]; }
 
-	sorted_list(char *buffer, const Sequence_set &seqs, const shape &sh, const shape_histogram &hst, const seedp_range &range):
+	/* Seed counts of a sequence set restricted to the seeds that pass a
+	filter. A list built from these counts is sized exactly, without space
+	for the filtered seeds. */
+	struct Filtered_histogram
+	{
+		Filtered_histogram(const Sequence_set &seqs, const shape &sh, const seedp_range &range, const Seed_filter &filter)
+		{
+			memset(data, 0, sizeof(data));
+			Count_context context (seqs, sh, range, filter, data);
+			launch_scheduled_thread_pool(context, Const::seqp, config.threads_);
+		}
+		shape_histogram data;
+	};
+
+	/* In CSR layout, the buffer holds the position arrays of all partitions,
+	followed by the scratch space in which the entries of one group of
+	partitions are built and sorted. */
+	static size_t csr_buffer_size(const shape_histogram &hst, const seedp_range &range)
+	{
+		const vector<unsigned> groups (csr_groups(hst, range));
+		size_t scratch = 0;
+		for(size_t i=0;i+1<groups.size();++i)
+			scratch = std::max(scratch, hst_size(hst, seedp_range(groups[i], groups[i+1])));
+		return sizeof(_pos) * hst_size(hst, range) + sizeof(entry) * scratch;
+	}
+
+	sorted_list(char *buffer, const Sequence_set &seqs, const shape &sh, const shape_histogram &hst, const seedp_range &range, const Seed_filter *filter = 0):
 		limits_ (hst, range),
-		data_ (reinterpret_cast<entry*>(buffer))
+		data_ (reinterpret_cast<entry*>(buffer)),
+		base_ (0),
+		pos_ (0),
+		csr_ (config.csr_index)
 	{
+		if(csr_) {
+			build_csr(buffer, seqs, sh, hst, range, filter);
+			return;
+		}
 		task_timer timer ("Building seed list", 3);
-		Build_context build_context (seqs, sh, range, build_iterators(hst));
+		Build_context build_context (seqs, sh, range, build_iterators(hst, range), filter);
 		launch_scheduled_thread_pool(build_context, Const::seqp, config.threads_);
 		timer.go("Sorting seed list");
-		Sort_context sort_context (*this);
+		Sort_context sort_context (*this, all_partitions());
 		launch_scheduled_thread_pool(sort_context, Const::seedp, config.threads_);
 	}
 
+	/* Moves the positions of a list in CSR layout that was built in place
+	into a new buffer of their exact size. Returns the new buffer; the old
+	one is no longer referenced. */
+	char* shrink()
+	{
+		_pos *pos = reinterpret_cast<_pos*>(new char[sizeof(_pos) * limits_.back()]);
+		for(unsigned p=0;p<Const::seedp;++p)
+			memcpy(pos + limits_[p], pos_begin(p), sizeof(_pos) * dir_[p].back().begin);
+		pos_ = pos;
+		data_ = 0;
+		return reinterpret_cast<char*>(pos);
+	}
+
+	/* Builds the lists of all shapes for one seed partition range with a
+	single scan over the sequences, emitting the seeds of every shape at each
+	position. One buffer per shape has to be supplied. */
+	static vector<sorted_list*> build_all(const vector<char*> &buffers, const Sequence_set &seqs, const seed_histogram &hst, const seedp_range &range)
+	{
+		task_timer timer ("Building seed lists", 3);
+		vector<sorted_list*> lists;
+		vector<Ptr_set*> iterators;
+		for(unsigned sid=0;sid<shapes.count();++sid) {
+			const shape_histogram &h = hst.get(config.index_mode, sid);
+			lists.push_back(new sorted_list (buffers[sid], h, range));
+			iterators.push_back(lists.back()->build_iterators(h, range));
+		}
+		Multi_build_context build_context (seqs, range, iterators);
+		launch_scheduled_thread_pool(build_context, Const::seqp, config.threads_);
+		for(unsigned sid=0;sid<shapes.count();++sid)
+			delete iterators[sid];
+
+		timer.go("Sorting seed lists");
+		for(unsigned sid=0;sid<shapes.count();++sid) {
+			Sort_context sort_context (*lists[sid], all_partitions());
+			launch_scheduled_thread_pool(sort_context, Const::seedp, config.threads_);
+		}
+		return lists;
+	}
+
 	template<typename _t>
 	struct Iterator_base
 	{
 		Iterator_base(_t *i, _t *end):
 			i (i),
 			end (end),
+			dir (0),
+			dir_end (0),
+			pos (0),
+			n (count())
+		{ }
+		Iterator_base(const Key_entry *dir, const Key_entry *dir_end, _pos *pos):
+			i (0),
+			end (0),
+			dir (dir),
+			dir_end (dir_end),
+			pos (pos),
 			n (count())
 		{ }
 		size_t count() const
 		{
+			if(dir)
+				return dir < dir_end ? dir[1].begin - dir[0].begin : 0;
 			_t *k (i);
 			size_t n (0);
 			while(k < end && (k++)->key == i->key)
@@ -81,32 +192,150 @@ struct sorted_list
 			return n;
 		}
 		void operator++()
-		{ i += n; n = count(); }
+		{
+			if(dir)
+				++dir;
+			else
+				i += n;
+			n = count();
+		}
 		Loc operator[](unsigned k) const
-		{ return (Loc)((i+k)->value); }
-		_t* get(unsigned k)
-		{ return i+k; }
+		{ return dir ? (Loc)pos[dir->begin+k] : (Loc)((i+k)->value); }
+		void set(unsigned k, Loc value)
+		{
+			if(dir)
+				pos[dir->begin+k] = value;
+			else
+				i[k].value = value;
+		}
+		/* Advances to the first key not less than the given key using
+		exponential search. */
+		void seek(unsigned key)
+		{
+			if(dir)
+				dir = gallop(dir, dir_end, key);
+			else
+				i = gallop(i, end, key);
+			n = count();
+		}
+		size_t size() const
+		{ return dir ? dir_end->begin - dir->begin : end - i; }
 		bool at_end() const
-		{ return i >= end; }
+		{ return dir ? dir >= dir_end : i >= end; }
 		unsigned key() const
-		{ return i->key; }
+		{ return dir ? dir->key : i->key; }
 		_t *i, *end;
+		const Key_entry *dir, *dir_end;
+		_pos *pos;
 		size_t n;
 	};
 
+	template<typename _it>
+	static _it gallop(_it begin, _it end, unsigned key)
+	{
+		if(begin >= end || begin->key >= key)
+			return begin;
+		ptrdiff_t lo = 0, hi = 1;
+		const ptrdiff_t n = end - begin;
+		while(hi < n && begin[hi].key < key) {
+			lo = hi;
+			hi <<= 1;
+		}
+		if(hi > n)
+			hi = n;
+		while(hi - lo > 1) {
+			const ptrdiff_t mid = lo + (hi - lo) / 2;
+			if(begin[mid].key < key)
+				lo = mid;
+			else
+				hi = mid;
+		}
+		return begin + hi;
+	}
+
 	typedef Iterator_base<entry> iterator;
 	typedef Iterator_base<const entry> const_iterator;
 
 	const_iterator get_partition_cbegin(unsigned p) const
-	{ return const_iterator (cptr_begin(p), cptr_end(p)); }
+	{
+		if(csr_)
+			return const_iterator (dir_[p].data(), dir_[p].data()+dir_[p].size()-1, pos_begin(p));
+		return const_iterator (cptr_begin(p), cptr_end(p));
+	}
+
+	/* Returns the position of the current key group of the iterator within
+	partition p, counted in seed positions. */
+	size_t offset(unsigned p, const const_iterator &i) const
+	{ return i.dir ? i.dir->begin : i.i - cptr_begin(p); }
 
 	iterator get_partition_begin(unsigned p) const
-	{ return iterator (ptr_begin(p), ptr_end(p)); }
+	{
+		if(csr_)
+			return iterator (dir_[p].data(), dir_[p].data()+dir_[p].size()-1, pos_begin(p));
+		return iterator (ptr_begin(p), ptr_end(p));
+	}
 
 private:
 
 	typedef Static_matrix<entry*,Const::seqp,Const::seedp> Ptr_set;
 
+	sorted_list(char *buffer, const shape_histogram &hst, const seedp_range &range):
+		limits_ (hst, range),
+		data_ (reinterpret_cast<entry*>(buffer)),
+		base_ (0),
+		pos_ (0),
+		csr_ (config.csr_index)
+	{ }
+
+	enum { csr_passes = 8 };
+
+	static seedp_range all_partitions()
+	{ return seedp_range (0, Const::seedp); }
+
+	/* Splits the range into groups of consecutive partitions holding about
+	1/csr_passes of the entries each. Returns the group boundaries. */
+	static vector<unsigned> csr_groups(const shape_histogram &hst, const seedp_range &range)
+	{
+		const size_t target = (hst_size(hst, range) + csr_passes - 1) / csr_passes;
+		vector<unsigned> groups (1, range.begin());
+		size_t n = 0;
+		for(unsigned p=range.begin();p<range.end();++p) {
+			const size_t s = partition_size(hst, p);
+			if(n > 0 && n + s > target) {
+				groups.push_back(p);
+				n = 0;
+			}
+			n += s;
+		}
+		groups.push_back(range.end());
+		return groups;
+	}
+
+	/* Builds the list in CSR layout. The sequences are scanned once per group
+	of partitions, so that only the entries of one group need to be held in
+	the 9-byte form before they are reduced to positions. */
+	void build_csr(char *buffer, const Sequence_set &seqs, const shape &sh, const shape_histogram &hst, const seedp_range &range, const Seed_filter *filter)
+	{
+		task_timer timer ("Building seed list", 3);
+		pos_ = reinterpret_cast<_pos*>(buffer);
+		data_ = reinterpret_cast<entry*>(buffer + sizeof(_pos) * limits_.back());
+		const vector<unsigned> groups (csr_groups(hst, range));
+		for(size_t i=0;i+1<groups.size();++i) {
+			const seedp_range group (groups[i], groups[i+1]);
+			base_ = limits_[group.begin()];
+			timer.go("Building seed list");
+			Build_context build_context (seqs, sh, group, build_iterators(hst, group), filter);
+			launch_scheduled_thread_pool(build_context, Const::seqp, config.threads_);
+			timer.go("Sorting seed list");
+			Sort_context sort_context (*this, group);
+			launch_scheduled_thread_pool(sort_context, Const::seedp, config.threads_);
+		}
+		for(unsigned p=0;p<Const::seedp;++p)
+			if(!range.contains(p))
+				dir_[p].assign(1, Key_entry (0, 0));
+		data_ = 0;
+	}
+
 	struct buffered_iterator
 	{
 		static const unsigned BUFFER_SIZE = 16;
@@ -115,10 +344,10 @@ private:
 			memset(n, 0, sizeof(n));
 			memcpy(this->ptr, ptr, sizeof(this->ptr));
 		}
-		void push(Packed_seed key, Loc value, const seedp_range &range)
+		void push(Packed_seed key, Loc value, const seedp_range &range, const Seed_filter *filter)
 		{
 			const unsigned p (seed_partition(key));
-			if(range.contains(p)) {
+			if(range.contains(p) && (filter == 0 || filter->contains(p, seed_partition_offset(key)))) {
 				assert(n[p] < BUFFER_SIZE);
 				buf[p][n[p]++] = entry (seed_partition_offset(key), value);
 				if(n[p] == BUFFER_SIZE)
@@ -143,25 +372,31 @@ private:
 	};
 
 	entry* ptr_begin(unsigned i) const
-	{ return &data_[limits_[i]]; }
+	{ return &data_[limits_[i] - base_]; }
 
 	entry* ptr_end(unsigned i) const
-	{ return &data_[limits_[i+1]]; }
+	{ return &data_[limits_[i+1] - base_]; }
 
 	const entry* cptr_begin(unsigned i) const
-	{ return &data_[limits_[i]]; }
+	{ return &data_[limits_[i] - base_]; }
 
 	const entry* cptr_end(unsigned i) const
-	{ return &data_[limits_[i+1]]; }
+	{ return &data_[limits_[i+1] - base_]; }
+
+	/* Position array of a partition in CSR layout. Lists built in place keep
+	it at the start of the entries of the partition. */
+	_pos* pos_begin(unsigned i) const
+	{ return pos_ ? pos_ + limits_[i] : reinterpret_cast<_pos*>(ptr_begin(i)); }
 
 	struct Build_context
 	{
-		Build_context(const Sequence_set &seqs, const shape &sh, const seedp_range &range, Ptr_set *iterators):
+		Build_context(const Sequence_set &seqs, const shape &sh, const seedp_range &range, Ptr_set *iterators, const Seed_filter *filter):
 			seqs (seqs),
 			sh (sh),
 			range (range),
 			iterators (iterators),
-			seq_partition (seqs.partition())
+			seq_partition (seqs.partition()),
+			filter (filter)
 		{ }
 		void operator()(unsigned thread_id, unsigned seqp) const
 		{
@@ -170,53 +405,159 @@ private:
 					seq_partition[seqp+1],
 					(*iterators)[seqp],
 					sh,
-					range);
+					range,
+					filter);
 		}
 		const Sequence_set &seqs;
 		const shape &sh;
 		const seedp_range &range;
 		const auto_ptr<Ptr_set> iterators;
 		const vector<size_t> seq_partition;
+		const Seed_filter *filter;
 	};
 
-	static void build_seqp(const Sequence_set &seqs, size_t begin, size_t end, entry **ptr, const shape &sh, const seedp_range &range)
+	static void build_seqp(const Sequence_set &seqs, size_t begin, size_t end, entry **ptr, const shape &sh, const seedp_range &range, const Seed_filter *filter)
 	{
 		uint64_t key;
 		auto_ptr<buffered_iterator> it (new buffered_iterator(ptr));
+		vector<Letter> buf;
 		for(size_t i=begin;i<end;++i) {
 			const sequence seq = seqs[i];
 			if(seq.length()<sh.length_) continue;
+			const Letter *r = reduce_seed_letters(&seq[0], seq.length(), buf);
 			for(unsigned j=0;j<seq.length()-sh.length_+1; ++j) {
-				if(sh.set_seed(key, &seq[j]))
-					it->push(key, seqs.position(i, j), range);
+				if(sh.set_seed_reduced(key, &r[j]))
+					it->push(key, seqs.position(i, j), range, filter);
 			}
 		}
 		it->flush();
 	}
 
-	Ptr_set* build_iterators(const shape_histogram &hst) const
+	struct Count_context
+	{
+		Count_context(const Sequence_set &seqs, const shape &sh, const seedp_range &range, const Seed_filter &filter, shape_histogram &hst):
+			seqs (seqs),
+			sh (sh),
+			range (range),
+			filter (filter),
+			seq_partition (seqs.partition()),
+			hst (hst)
+		{ }
+		void operator()(unsigned thread_id, unsigned seqp) const
+		{
+			uint64_t key;
+			vector<Letter> buf;
+			int32_t *counts = hst[seqp];
+			for(size_t i=seq_partition[seqp];i<seq_partition[seqp+1];++i) {
+				const sequence seq = seqs[i];
+				if(seq.length()<sh.length_) continue;
+				const Letter *r = reduce_seed_letters(&seq[0], seq.length(), buf);
+				for(unsigned j=0;j<seq.length()-sh.length_+1; ++j) {
+					if(sh.set_seed_reduced(key, &r[j])) {
+						const unsigned p (seed_partition(key));
+						if(range.contains(p) && filter.contains(p, seed_partition_offset(key)))
+							++counts[p];
+					}
+				}
+			}
+		}
+		const Sequence_set &seqs;
+		const shape &sh;
+		const seedp_range &range;
+		const Seed_filter &filter;
+		const vector<size_t> seq_partition;
+		shape_histogram &hst;
+	};
+
+	struct Multi_build_context
+	{
+		Multi_build_context(const Sequence_set &seqs, const seedp_range &range, const vector<Ptr_set*> &iterators):
+			seqs (seqs),
+			range (range),
+			iterators (iterators),
+			seq_partition (seqs.partition())
+		{ }
+		void operator()(unsigned thread_id, unsigned seqp) const
+		{
+			const unsigned n_shapes = shapes.count();
+			vector<buffered_iterator*> it;
+			for(unsigned k=0;k<n_shapes;++k)
+				it.push_back(new buffered_iterator((*iterators[k])[seqp]));
+			uint64_t key;
+			vector<Letter> buf;
+			for(size_t i=seq_partition[seqp];i<seq_partition[seqp+1];++i) {
+				const sequence seq = seqs[i];
+				const size_t len = seq.length();
+				if(len < Const::min_shape_len) continue;
+				const Letter *r = reduce_seed_letters(&seq[0], len, buf);
+				for(unsigned j=0;j+Const::min_shape_len<=len; ++j)
+					for(unsigned k=0;k<n_shapes;++k) {
+						const shape &sh = shapes.get_shape(k);
+						if(j+sh.length_ <= len && sh.set_seed_reduced(key, &r[j]))
+							it[k]->push(key, seqs.position(i, j), range, 0);
+					}
+			}
+			for(unsigned k=0;k<n_shapes;++k) {
+				it[k]->flush();
+				delete it[k];
+			}
+		}
+		const Sequence_set &seqs;
+		const seedp_range &range;
+		const vector<Ptr_set*> &iterators;
+		const vector<size_t> seq_partition;
+	};
+
+	Ptr_set* build_iterators(const shape_histogram &hst, const seedp_range &range) const
 	{
 		Ptr_set *iterators = new Ptr_set;
 		for(unsigned i=0;i<Const::seedp;++i)
-			(*iterators)[0][i] = ptr_begin(i);
+			(*iterators)[0][i] = range.contains(i) ? ptr_begin(i) : 0;
 
 		for(unsigned i=1;i<Const::seqp;++i) {
 			for(unsigned j=0;j<Const::seedp;++j)
-				(*iterators)[i][j] = (*iterators)[i-1][j] + hst[i-1][j];
+				(*iterators)[i][j] = range.contains(j) ? (*iterators)[i-1][j] + hst[i-1][j] : 0;
 		}
 		return iterators;
 	}
 
 	struct Sort_context
 	{
-		Sort_context(sorted_list &sl):
-			sl (sl)
+		Sort_context(sorted_list &sl, const seedp_range &range):
+			sl (sl),
+			range (range)
 		{ }
 		void operator()(unsigned thread_id ,unsigned seedp) const
-		{ std::sort(sl.ptr_begin(seedp), sl.ptr_end(seedp)); }
+		{
+			if(!range.contains(seedp))
+				return;
+			std::sort(sl.ptr_begin(seedp), sl.ptr_end(seedp));
+			if(sl.csr_)
+				sl.build_directory(seedp);
+		}
 		sorted_list &sl;
+		const seedp_range range;
 	};
 
+	/* Converts a sorted partition to CSR layout: the positions are written to
+	the position array of the partition and the keys are collected in the key
+	directory, terminated by a sentinel entry. */
+	void build_directory(unsigned p)
+	{
+		const entry *e = ptr_begin(p);
+		const size_t n = ptr_end(p) - e;
+		_pos *pos = pos_begin(p);
+		vector<Key_entry> &dir = dir_[p];
+		dir.clear();
+		for(size_t j=0;j<n;++j) {
+			const entry x = e[j];
+			if(dir.empty() || x.key != dir.back().key)
+				dir.push_back(Key_entry (x.key, (uint32_t)j));
+			pos[j] = x.value;
+		}
+		dir.push_back(Key_entry (0, (uint32_t)n));
+	}
+
 	struct Limits : vector<size_t>
 	{
 		Limits(const shape_histogram &hst, const seedp_range &range)
@@ -234,6 +575,10 @@ private:
 
 	const Limits limits_;
 	entry *data_;
+	size_t base_;
+	_pos *pos_;
+	const bool csr_;
+	vector<Key_entry> dir_[Const::seedp];
 
 };
 
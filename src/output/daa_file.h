@@ -21,6 +21,7 @@ LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR P
 
 #include <string>
 #include <exception>
+#include <zlib.h>
 #include "../util/ptr_vector.h"
 #include "../basic/config.h"
 #include "../basic/const.h"
@@ -84,7 +85,7 @@ struct DAA_header2
 		memset(block_size, 0, sizeof(block_size));
 		strcpy(this->score_matrix, score_matrix.c_str());
 	}
-	typedef enum { empty = 0, alignments = 1, ref_names = 2, ref_lengths = 3 } Block_type;
+	typedef enum { empty = 0, alignments = 1, ref_names = 2, ref_lengths = 3, compressed_alignments = 4, alignment_index = 5 } Block_type;
 	uint64_t diamond_build, db_seqs, db_seqs_used, db_letters, flags, query_records;
 	int32_t mode, gap_open, gap_extend, reward, penalty, reserved1, reserved2, reserved3;
 	double k, lambda, evalue, reserved5;
@@ -93,12 +94,76 @@ struct DAA_header2
 	char block_type[256];
 };
 
+/* Block of a compressed alignment section (DAA version 1). The section is
+a sequence of blocks that each hold whole query records deflated together,
+terminated by a header with compressed_size 0. Blocks are independent, so
+they can be decompressed in parallel. The alignment_index block lists the
+file offset and first query number of every block. */
+struct DAA_block
+{
+
+	enum { target_size = 1 << 18 };
+
+	struct Header
+	{
+		uint32_t compressed_size, size, records;
+	};
+
+	DAA_block():
+		query_num (0)
+	{
+		header.compressed_size = header.size = header.records = 0;
+	}
+
+	void decompress(vector<char> &out) const
+	{
+		out.resize(header.size);
+		uLongf n = header.size;
+		if (uncompress((Bytef*)out.data(), &n, (const Bytef*)data.data(), (uLong)data.size()) != Z_OK || n != header.size)
+			throw std::runtime_error("Error decompressing DAA block.");
+	}
+
+	/* Copies the query record at pos of a decompressed block to buf. */
+	static void get_record(const vector<char> &block, size_t &pos, Binary_buffer &buf)
+	{
+		uint32_t size;
+		if (pos + sizeof(size) > block.size())
+			throw std::runtime_error("Unexpected end of DAA block.");
+		memcpy(&size, &block[pos], sizeof(size));
+		pos += sizeof(size);
+		if (pos + size > block.size())
+			throw std::runtime_error("Unexpected end of DAA block.");
+		buf.assign(block.begin() + pos, block.begin() + pos + size);
+		pos += size;
+	}
+
+	static void write(const char *ptr, size_t n, uint32_t records, Output_stream &f, vector<char> &buf)
+	{
+		uLongf l = compressBound((uLong)n);
+		buf.resize(l);
+		if (compress((Bytef*)buf.data(), &l, (const Bytef*)ptr, (uLong)n) != Z_OK)
+			throw std::runtime_error("Error compressing DAA block.");
+		Header h;
+		h.compressed_size = (uint32_t)l;
+		h.size = (uint32_t)n;
+		h.records = records;
+		f.typed_write(&h, 1);
+		f.write(buf.data(), l);
+	}
+
+	Header header;
+	vector<char> data;
+	size_t query_num;
+
+};
+
 struct DAA_file
 {
 
 	DAA_file(const string& file_name):
 		f_ (file_name),
-		query_count_ (0)
+		query_count_ (0),
+		block_pos_ (0)
 	{
 		f_.read(&h1_, 1);
 		if(h1_.magic_number != DAA_header1().magic_number)
@@ -113,6 +178,7 @@ struct DAA_file
 		Config::set_option(config.db_size, h2_.db_letters);
 		align_mode = Align_mode(h2_.mode);
 		ref_header.sequences = h2_.db_seqs;
+		compressed_ = h2_.block_type[0] == DAA_header2::compressed_alignments;
 
 		f_.seek(sizeof(DAA_header1) + sizeof(DAA_header2) + (size_t)h2_.block_size[0]);
 		string s;
@@ -186,8 +252,41 @@ struct DAA_file
 		return h2_.evalue;
 	}
 
+	bool compressed() const
+	{ return compressed_; }
+
+	/* Whether records of a block decompressed by read_query_buffer() are
+	still to be read. */
+	bool pending() const
+	{ return block_pos_ < block_data_.size(); }
+
+	/* Reads the next block of a compressed file without decompressing it. */
+	bool read_block(DAA_block &block)
+	{
+		f_.read(&block.header, 1);
+		if (block.header.compressed_size == 0)
+			return false;
+		block.data.resize(block.header.compressed_size);
+		f_.read(block.data.data(), block.header.compressed_size);
+		block.query_num = query_count_;
+		query_count_ += block.header.records;
+		return true;
+	}
+
 	bool read_query_buffer(Binary_buffer &buf, size_t &query_num)
 	{
+		if (compressed_) {
+			if (!pending()) {
+				if (!read_block(block_))
+					return false;
+				block_.decompress(block_data_);
+				block_pos_ = 0;
+				block_query_ = block_.query_num;
+			}
+			DAA_block::get_record(block_data_, block_pos_, buf);
+			query_num = block_query_++;
+			return true;
+		}
 		uint32_t size;
 		f_.read(&size, 1);
 		if(size == 0)
@@ -201,7 +300,10 @@ struct DAA_file
 private:
 
 	Input_stream f_;
-	size_t query_count_;
+	size_t query_count_, block_pos_, block_query_;
+	bool compressed_;
+	DAA_block block_;
+	vector<char> block_data_;
 	DAA_header1 h1_;
 	DAA_header2 h2_;
 	Ptr_vector<string> ref_name_;
@@ -18,39 +18,62 @@ LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR P
 
 #include "daa_record.h"
 
-void DAA_query_record::Match::parse()
+static void parse_transcript(Hsp_data &hsp, const vector<Letter> &query)
 {
-	length = identities = mismatches = gap_openings = positives = gaps = 0;
-	unsigned d = 0;
-	Hsp_context context = this->context();
-	Hsp_context::Iterator i = context.begin();
+	hsp.length = hsp.identities = hsp.mismatches = hsp.gap_openings = hsp.positives = hsp.gaps = 0;
+	unsigned d = 0, query_pos = hsp.query_range.begin_, subject_pos = hsp.subject_range.begin_;
 
-	for (; i.good(); ++i) {
-		++length;
-		switch (i.op()) {
+	for (const Packed_operation *i = hsp.transcript.ptr(); *i != Packed_operation::terminator(); ++i) {
+		const unsigned n = i->count();
+		hsp.length += n;
+		switch (i->op()) {
 		case op_match:
-			++identities;
-			++positives;
+			hsp.identities += n;
+			hsp.positives += n;
+			query_pos += n;
+			subject_pos += n;
 			d = 0;
 			break;
 		case op_substitution:
-			++mismatches;
-			if (i.score() > 0)
-				++positives;
+			++hsp.mismatches;
+			if (!query.empty() && score_matrix(query[query_pos], i->letter()) > 0)
+				++hsp.positives;
+			++query_pos;
+			++subject_pos;
 			d = 0;
 			break;
 		case op_insertion:
 		case op_deletion:
 			if (d == 0)
-				++gap_openings;
-			++d;
-			++gaps;
+				++hsp.gap_openings;
+			d += n;
+			hsp.gaps += n;
+			if (i->op() == op_insertion)
+				query_pos += n;
+			else
+				subject_pos += n;
 			break;
 		}
 	}
 
-	query_range.end_ = i.query_pos;
-	subject_range.end_ = i.subject_pos;
+	hsp.query_range.end_ = query_pos;
+	hsp.subject_range.end_ = subject_pos;
+}
+
+void decode_hsp(Hsp_data &hsp, unsigned mode, uint32_t query_begin, bool reverse, const vector<Letter> &source_seq, const vector<Letter> *context)
+{
+	if (mode == Align_mode::blastx) {
+		hsp.frame = !reverse ? query_begin % 3 : 3 + (source_seq.size() - 1 - query_begin) % 3;
+		hsp.set_translated_query_begin(query_begin, (unsigned)source_seq.size());
+		parse_transcript(hsp, context[hsp.frame]);
+		hsp.query_source_range = hsp.frame < 3 ? interval(query_begin, query_begin + 3 * hsp.query_range.length()) : interval(query_begin + 1 - 3 * hsp.query_range.length(), query_begin + 1);
+	}
+	else if (mode == Align_mode::blastp) {
+		hsp.frame = 0;
+		hsp.query_range.begin_ = query_begin;
+		parse_transcript(hsp, context[0]);
+		hsp.query_source_range = hsp.query_range;
+	}
 }
 
 Binary_buffer::Iterator DAA_query_record::init(const Binary_buffer &buf)
@@ -69,7 +92,8 @@ Binary_buffer::Iterator DAA_query_record::init(const Binary_buffer &buf)
 		const bool have_n = (flags & 1) == 1;
 		Packed_sequence seq(it, query_len, have_n, have_n ? 3 : 2);
 		seq.unpack(source_seq, have_n ? 3 : 2, query_len);
-		translate_query(source_seq, context);
+		if (need_query_seq_)
+			translate_query(source_seq, context);
 	}
 	return it;
 }
@@ -91,19 +115,8 @@ Binary_buffer::Iterator& operator>>(Binary_buffer::Iterator &it, DAA_query_recor
 	it.read_packed((flag >> 2) & 3, query_begin);
 	it.read_packed((flag >> 4) & 3, r.subject_range.begin_);
 	r.transcript.read(it);
-	r.subject_name = r.parent_.file_.ref_name(r.subject_id);
+	r.subject_name = r.parent_.file_.ref_name(r.subject_id).c_str();
 	r.subject_len = r.parent_.file_.ref_len(r.subject_id);
-	if (r.parent_.file_.mode() == Align_mode::blastx) {
-		r.frame = (flag&(1 << 6)) == 0 ? query_begin % 3 : 3 + (r.parent_.source_seq.size() - 1 - query_begin) % 3;
-		r.set_translated_query_begin(query_begin, (unsigned)r.parent_.source_seq.size());
-		r.parse();
-		r.query_source_range = r.frame < 3 ? interval(query_begin, query_begin + 3 * r.query_range.length()) : interval(query_begin + 1 - 3 * r.query_range.length(), query_begin + 1);
-	}
-	else if (r.parent_.file_.mode() == Align_mode::blastp) {
-		r.frame = 0;
-		r.query_range.begin_ = query_begin;
-		r.parse();
-		r.query_source_range = r.query_range;
-	}
+	decode_hsp(r, r.parent_.file_.mode(), query_begin, (flag&(1 << 6)) != 0, r.parent_.source_seq, r.parent_.context);
 	return it;
 }
\ No newline at end of file
@@ -42,6 +42,22 @@ inline void translate_query(const vector<Letter>& query, vector<Letter> *context
 	Translator::translate(query, context);
 }
 
+/* Query sequence of the given frame. If a translated query has not been
+translated, only the length of the frame is set. */
+inline sequence query_frame(const vector<Letter> &source_seq, const vector<Letter> *context, unsigned frame)
+{
+	if (context[frame].empty() && !source_seq.empty()) {
+		const size_t offset = frame % 3;
+		return sequence(0, source_seq.size() > offset ? (source_seq.size() - offset) / 3 : 0);
+	}
+	return sequence(context[frame]);
+}
+
+/* Completes an HSP read from a DAA record: sets the frame and query ranges
+from the stored oriented query begin and strand flag, and counts the
+alignment statistics of the transcript. */
+void decode_hsp(Hsp_data &hsp, unsigned mode, uint32_t query_begin, bool reverse, const vector<Letter> &source_seq, const vector<Letter> *context);
+
 struct DAA_query_record
 {
 
@@ -51,20 +67,21 @@ struct DAA_query_record
 		Match(const DAA_query_record &query_record) :
 			hit_num(std::numeric_limits<uint32_t>::max()),
 			subject_id(std::numeric_limits<uint32_t>::max()),
+			subject_name(0),
 			parent_(query_record)
 		{ }
 
 		Hsp_context context() const
 		{
-			return Hsp_context(*this, sequence(parent_.context[frame]), parent_.query_name.c_str(), subject_name.c_str(), subject_len, hit_num, hsp_num);
+			return Hsp_context(*this, parent_.query_seq(frame), parent_.query_name.c_str(), subject_id, subject_name, subject_len, hit_num, hsp_num);
 		}
 
 		uint32_t hsp_num, hit_num, subject_id, subject_len;
-		string subject_name;
+		/* Points into the reference names held by the DAA file. */
+		const char *subject_name;
 
 	private:
 
-		void parse();
 		const DAA_query_record &parent_;
 		friend Binary_buffer::Iterator& operator>>(Binary_buffer::Iterator &it, Match &r);
 
@@ -101,9 +118,12 @@ struct DAA_query_record
 		bool good_;
 	};
 
-	DAA_query_record(const DAA_file& file, const Binary_buffer &buf, size_t query_num):
+	/* Without need_query_seq, translated queries are not translated and
+	positives are not counted. */
+	DAA_query_record(const DAA_file& file, const Binary_buffer &buf, size_t query_num, bool need_query_seq = true):
 		query_num (query_num),
 		file_(file),
+		need_query_seq_(need_query_seq),
 		it_(init(buf))
 	{ }
 
@@ -117,6 +137,11 @@ struct DAA_query_record
 		return align_mode.query_translated ? source_seq.size() : context[0].size();
 	}
 
+	sequence query_seq(unsigned frame) const
+	{
+		return query_frame(source_seq, context, frame);
+	}
+
 	string query_name;
 	size_t query_num;
 	vector<Letter> source_seq;
@@ -127,6 +152,7 @@ private:
 	Binary_buffer::Iterator init(const Binary_buffer &buf);
 
 	const DAA_file& file_;
+	const bool need_query_seq_;
 	const Binary_buffer::Iterator it_;
 	
 	friend Binary_buffer::Iterator& operator>>(Binary_buffer::Iterator &it, Match &r);
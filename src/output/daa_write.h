@@ -54,7 +54,65 @@ uint8_t get_segment_flag(const Segment &match)
 		| rev << 6);
 }
 
-struct DAA_output
+/* Collects the query records written to the alignment section and writes
+them as compressed blocks. Records may arrive split across writes. */
+struct DAA_block_ostream : public Output_stream
+{
+
+	DAA_block_ostream(Output_stream &f):
+		f_ (f),
+		parsed_ (0),
+		records_ (0),
+		query_num_ (0)
+	{ }
+
+	virtual void write(const char *ptr, size_t count)
+	{
+		buf_.insert(buf_.end(), ptr, ptr + count);
+		uint32_t size;
+		while (parsed_ + sizeof(size) <= buf_.size()) {
+			memcpy(&size, &buf_[parsed_], sizeof(size));
+			if (parsed_ + sizeof(size) + size > buf_.size())
+				break;
+			parsed_ += sizeof(size) + size;
+			++records_;
+		}
+		if (parsed_ >= DAA_block::target_size)
+			flush();
+	}
+
+	void flush()
+	{
+		if (records_ == 0)
+			return;
+		index_.push_back(f_.tell());
+		index_.push_back(query_num_);
+		DAA_block::write(buf_.data(), parsed_, records_, f_, compressed_);
+		buf_.erase(buf_.begin(), buf_.begin() + parsed_);
+		query_num_ += records_;
+		parsed_ = 0;
+		records_ = 0;
+	}
+
+	virtual void close()
+	{ }
+
+	/* File offset and first query number of each block. */
+	const vector<uint64_t>& index() const
+	{ return index_; }
+
+private:
+
+	Output_stream &f_;
+	vector<char> buf_, compressed_;
+	size_t parsed_;
+	uint32_t records_;
+	uint64_t query_num_;
+	vector<uint64_t> index_;
+
+};
+
+struct DAA_output : public Master_output
 {
 
 	DAA_output() :
@@ -69,13 +127,17 @@ struct DAA_output
 			score_matrix.lambda(),
 			config.max_evalue,
 			config.matrix,
-			align_mode.mode)
+			align_mode.mode),
+		block_out_(config.compression == 1 ? new DAA_block_ostream(f_) : 0)
 	{
 		DAA_header1 h1;
+		h1.version = block_out_.get() ? 1 : 0;
 		f_.typed_write(&h1, 1);
-		h2_.block_type[0] = DAA_header2::alignments;
+		h2_.block_type[0] = block_out_.get() ? DAA_header2::compressed_alignments : DAA_header2::alignments;
 		h2_.block_type[1] = DAA_header2::ref_names;
 		h2_.block_type[2] = DAA_header2::ref_lengths;
+		if (block_out_.get())
+			h2_.block_type[3] = DAA_header2::alignment_index;
 		f_.typed_write(&h2_, 1);
 	}
 
@@ -114,10 +176,17 @@ struct DAA_output
 		buf << match.traceback_->transcript.data();
 	}
 
-	void finish()
+	virtual void finish()
 	{
-		uint32_t size = 0;
-		f_.typed_write(&size, 1);
+		if (block_out_.get()) {
+			block_out_->flush();
+			DAA_block::Header end;
+			end.compressed_size = end.size = end.records = 0;
+			f_.typed_write(&end, 1);
+		} else {
+			uint32_t size = 0;
+			f_.typed_write(&size, 1);
+		}
 		h2_.block_size[0] = f_.tell() - sizeof(DAA_header1) - sizeof(DAA_header2);
 		h2_.db_seqs_used = ref_map.next_;
 		h2_.query_records = statistics.get(Statistics::ALIGNED);
@@ -132,19 +201,25 @@ struct DAA_output
 		f_.write(ref_map.len_, false);
 		h2_.block_size[2] = ref_map.len_.size() * sizeof(uint32_t);
 
+		if (block_out_.get()) {
+			f_.write(block_out_->index(), false);
+			h2_.block_size[3] = block_out_->index().size() * sizeof(uint64_t);
+		}
+
 		f_.seekp(sizeof(DAA_header1));
 		f_.typed_write(&h2_, 1);
 
 		f_.close();
 	}
 
-	Output_stream& stream()
-	{ return f_; }
+	virtual Output_stream& stream()
+	{ return block_out_.get() ? *block_out_ : f_; }
 
 private:
 
 	Output_stream f_;
 	DAA_header2 h2_;
+	auto_ptr<DAA_block_ostream> block_out_;
 
 };
 
@@ -0,0 +1,300 @@
+/****
+Copyright (c) 2016, University of Tuebingen, Benjamin Buchfink
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification, are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this list of conditions and the following disclaimer.
+
+2. Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the following disclaimer in the documentation and/or other materials provided with the distribution.
+
+3. Neither the name of the copyright holder nor the names of its contributors may be used to endorse or promote products derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+****/
+
+#ifndef HIT_TABLE_H_
+#define HIT_TABLE_H_
+
+#include <string.h>
+#include <stdint.h>
+#include <vector>
+#include <algorithm>
+#include <map>
+#include <string>
+#include <stdexcept>
+#include "../util/binary_file.h"
+#include "../util/text_buffer.h"
+
+using std::vector;
+using std::string;
+
+/* Binary hit table for analytics. The columns of the tabular format are
+stored column by column in row groups of up to row_group_size hits. A footer
+indexes the row groups and holds the subject names; it is located through
+the last 12 bytes of the file (footer offset and magic). All values are
+little endian and every column starts at a multiple of 8 bytes, so readers
+can map the file and scan only the columns they need.
+
+Row group:  column[n_columns], query table
+Query table: uint32 query_num[n], uint64 name_offset[n+1], chars
+Footer:     uint32 n_columns, uint32 row_group_size,
+            (char name[16], uint32 type, uint32 width)[n_columns],
+            uint64 n_groups,
+            (uint64 n_rows, uint64 n_queries, uint64 column_offset[n_columns], uint64 query_table_offset)[n_groups],
+            uint64 n_subjects, uint32 subject_id[n], uint64 name_offset[n+1], chars,
+            uint64 footer_offset, char magic[4] */
+struct Hit_table
+{
+
+	enum { row_group_size = 1 << 16 };
+	enum Column { query, subject, identity, length, mismatches, gap_openings, query_start, query_end, subject_start, subject_end, evalue, bit_score, n_columns };
+	enum Type { type_uint32 = 0, type_int32 = 1, type_float = 2, type_double = 3 };
+
+	/* Hit as passed from the output format to the stream, preceded by
+	record_hit and followed by the length prefixed subject name. Each query is
+	introduced by record_query, the query number and the query name. */
+	struct Row
+	{
+		uint32_t subject, length, mismatches, gap_openings;
+		int32_t query_start, query_end;
+		uint32_t subject_start, subject_end;
+		float identity, bit_score;
+		double evalue;
+	};
+
+	static const char record_query = 'Q', record_hit = 'H';
+
+	static const char* magic()
+	{ return "DHT1"; }
+
+	static void write_name(Text_buffer &buf, const char *name, size_t len)
+	{
+		buf.write((uint32_t)len);
+		buf.write_raw(name, len);
+	}
+
+};
+
+/* Output stream that turns the records of Hit_table_format into the binary
+hit table. Writers must pass whole query records. */
+struct Hit_table_ostream : public Output_stream
+{
+
+	Hit_table_ostream(const string &file_name):
+		Output_stream(file_name),
+		offset_ (0),
+		query_num_ (0),
+		closed_ (false)
+	{
+		write_bytes(Hit_table::magic(), 4);
+		pad();
+	}
+
+	virtual void write(const char *ptr, size_t count)
+	{
+		const char *end = ptr + count;
+		while (ptr < end) {
+			const char type = *(ptr++);
+			if (type == Hit_table::record_query) {
+				ptr = read(ptr, query_num_);
+				ptr = read_name(ptr, query_name_);
+				check_query_num();
+			} else if (type == Hit_table::record_hit) {
+				Hit_table::Row row;
+				ptr = read(ptr, row);
+				if (subjects_.find(row.subject) == subjects_.end())
+					ptr = read_name(ptr, subjects_[row.subject]);
+				else
+					ptr = skip_name(ptr);
+				if (queries_.empty() || queries_.back() != query_num_) {
+					queries_.push_back(query_num_);
+					query_names_.push_back(query_name_);
+				}
+				query_col_.push_back(query_num_);
+				rows_.push_back(row);
+				if (rows_.size() == Hit_table::row_group_size)
+					write_row_group();
+			} else
+				throw std::runtime_error("Invalid hit table record.");
+		}
+	}
+
+	virtual void close()
+	{
+		if (!closed_) {
+			write_row_group();
+			write_footer();
+			closed_ = true;
+		}
+		Output_stream::close();
+	}
+
+private:
+
+	struct Row_group
+	{
+		uint64_t n_rows, n_queries, column_offset[Hit_table::n_columns], query_table_offset;
+	};
+
+	template<typename _t>
+	static const char* read(const char *ptr, _t &x)
+	{
+		memcpy(&x, ptr, sizeof(_t));
+		return ptr + sizeof(_t);
+	}
+
+	static const char* read_name(const char *ptr, string &name)
+	{
+		uint32_t l;
+		ptr = read(ptr, l);
+		name.assign(ptr, l);
+		return ptr + l;
+	}
+
+	/* Every query is written once, so a repeated query number means that
+	rows would be attributed to the wrong query names. */
+	void check_query_num()
+	{
+		if (query_num_ >= seen_.size())
+			seen_.resize(std::max((size_t)query_num_ + 1, seen_.size() * 2));
+		if (seen_[query_num_])
+			throw std::runtime_error("Hit table: query number written twice.");
+		seen_[query_num_] = true;
+	}
+
+	static const char* skip_name(const char *ptr)
+	{
+		uint32_t l;
+		ptr = read(ptr, l);
+		return ptr + l;
+	}
+
+	void write_bytes(const void *ptr, size_t n)
+	{
+		Output_stream::write((const char*)ptr, n);
+		offset_ += n;
+	}
+
+	template<typename _t>
+	void write_value(const _t &x)
+	{
+		write_bytes(&x, sizeof(_t));
+	}
+
+	void pad()
+	{
+		static const char zero[8] = { 0 };
+		if (offset_ & 7)
+			write_bytes(zero, 8 - (offset_ & 7));
+	}
+
+	template<typename _t>
+	void write_column(const vector<_t> &v)
+	{
+		write_bytes(v.data(), v.size() * sizeof(_t));
+		pad();
+	}
+
+	template<typename _t>
+	void write_column(_t Hit_table::Row::*member, uint64_t &offset)
+	{
+		vector<_t> v;
+		v.reserve(rows_.size());
+		for (vector<Hit_table::Row>::const_iterator i = rows_.begin(); i != rows_.end(); ++i)
+			v.push_back((*i).*member);
+		offset = offset_;
+		write_column(v);
+	}
+
+	void write_names(const vector<string> &names)
+	{
+		vector<uint64_t> offsets;
+		offsets.push_back(0);
+		for (vector<string>::const_iterator i = names.begin(); i != names.end(); ++i)
+			offsets.push_back(offsets.back() + i->length());
+		write_column(offsets);
+		for (vector<string>::const_iterator i = names.begin(); i != names.end(); ++i)
+			write_bytes(i->data(), i->length());
+		pad();
+	}
+
+	void write_row_group()
+	{
+		if (rows_.empty())
+			return;
+		Row_group g;
+		g.n_rows = rows_.size();
+		g.n_queries = queries_.size();
+		g.column_offset[Hit_table::query] = offset_;
+		write_column(query_col_);
+		write_column(&Hit_table::Row::subject, g.column_offset[Hit_table::subject]);
+		write_column(&Hit_table::Row::identity, g.column_offset[Hit_table::identity]);
+		write_column(&Hit_table::Row::length, g.column_offset[Hit_table::length]);
+		write_column(&Hit_table::Row::mismatches, g.column_offset[Hit_table::mismatches]);
+		write_column(&Hit_table::Row::gap_openings, g.column_offset[Hit_table::gap_openings]);
+		write_column(&Hit_table::Row::query_start, g.column_offset[Hit_table::query_start]);
+		write_column(&Hit_table::Row::query_end, g.column_offset[Hit_table::query_end]);
+		write_column(&Hit_table::Row::subject_start, g.column_offset[Hit_table::subject_start]);
+		write_column(&Hit_table::Row::subject_end, g.column_offset[Hit_table::subject_end]);
+		write_column(&Hit_table::Row::evalue, g.column_offset[Hit_table::evalue]);
+		write_column(&Hit_table::Row::bit_score, g.column_offset[Hit_table::bit_score]);
+		g.query_table_offset = offset_;
+		write_column(queries_);
+		write_names(query_names_);
+		groups_.push_back(g);
+		rows_.clear();
+		query_col_.clear();
+		queries_.clear();
+		query_names_.clear();
+	}
+
+	void write_footer()
+	{
+		static const char *names[] = { "qseqid", "sseqid", "pident", "length", "mismatch", "gapopen", "qstart", "qend", "sstart", "send", "evalue", "bitscore" };
+		static const uint32_t types[] = { Hit_table::type_uint32, Hit_table::type_uint32, Hit_table::type_float, Hit_table::type_uint32, Hit_table::type_uint32, Hit_table::type_uint32,
+			Hit_table::type_int32, Hit_table::type_int32, Hit_table::type_uint32, Hit_table::type_uint32, Hit_table::type_double, Hit_table::type_float };
+		static const uint32_t widths[] = { 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 8, 4 };
+		const uint64_t footer_offset = offset_;
+		write_value((uint32_t)Hit_table::n_columns);
+		write_value((uint32_t)Hit_table::row_group_size);
+		for (unsigned i = 0; i < Hit_table::n_columns; ++i) {
+			char name[16] = { 0 };
+			strncpy(name, names[i], sizeof(name) - 1);
+			write_bytes(name, sizeof(name));
+			write_value(types[i]);
+			write_value(widths[i]);
+		}
+		write_value((uint64_t)groups_.size());
+		write_column(groups_);
+
+		vector<uint32_t> ids;
+		vector<string> subject_names;
+		for (std::map<uint32_t, string>::const_iterator i = subjects_.begin(); i != subjects_.end(); ++i) {
+			ids.push_back(i->first);
+			subject_names.push_back(i->second);
+		}
+		write_value((uint64_t)ids.size());
+		write_column(ids);
+		write_names(subject_names);
+		write_value(footer_offset);
+		write_bytes(Hit_table::magic(), 4);
+	}
+
+	uint64_t offset_;
+	uint32_t query_num_;
+	vector<bool> seen_;
+	string query_name_;
+	bool closed_;
+	vector<Hit_table::Row> rows_;
+	vector<uint32_t> query_col_, queries_;
+	vector<string> query_names_;
+	vector<Row_group> groups_;
+	std::map<uint32_t, string> subjects_;
+
+};
+
+#endif /* HIT_TABLE_H_ */
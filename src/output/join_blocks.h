@@ -24,27 +24,202 @@ Author: Benjamin Buchfink
 #include <algorithm>
 #include <vector>
 #include <limits>
+#include <map>
 #include "output_file.h"
+#include "../data/query_dedup.h"
+#include "../data/result_cache.h"
 
 using std::endl;
 using std::cout;
 using std::vector;
 
-void join_blocks(unsigned ref_blocks, DAA_output &master_out, const vector<Temp_file> &tmp_file)
+Temp_file sort_block_chunks(const Temp_file &tmp_file, vector<Block_chunk> &chunks)
+{
+	std::sort(chunks.begin(), chunks.end());
+	Temp_file out;
+	Input_stream in (tmp_file);
+	vector<char> buf;
+	for(vector<Block_chunk>::const_iterator i=chunks.begin();i!=chunks.end();++i) {
+		buf.resize(i->size);
+		in.seek(i->offset);
+		if(in.read(buf.data(), i->size) != i->size)
+			throw File_read_exception(in.file_name);
+		out.write(buf.data(), i->size);
+	}
+	in.close_and_delete();
+	return out;
+}
+
+void copy_block(const Temp_file &tmp_file, Master_output &master_out)
+{
+	Input_stream in (tmp_file);
+	vector<char> buf (1 << 20);
+	size_t n;
+	while((n = in.read(buf.data(), buf.size())) > 0)
+		master_out.stream().write(buf.data(), n);
+	in.close_and_delete();
+}
+
+/* Output records of a representative query, kept until they have been
+repeated for all of its duplicates. */
+struct Query_copies
+{
+	unsigned pending, pairwise;
+	vector<Intermediate_record> records;
+};
+
+/* Query number within the chunk, before the cached queries were removed. */
+inline unsigned chunk_query(unsigned query)
+{ return Cached_queries::instance ? Cached_queries::instance->original(query) : query; }
+
+/* Writes the duplicate at the given position. */
+void write_duplicate(vector<pair<unsigned,unsigned> >::const_iterator dup,
+		std::map<unsigned,Query_copies> &copies,
+		Output_buffer &buf,
+		Master_output &master_out)
+{
+	std::map<unsigned,Query_copies>::iterator i = copies.find(dup->second);
+	if(i == copies.end())
+		return;
+	statistics.inc(Statistics::ALIGNED);
+	buf.write_query_record(chunk_query(dup->first));
+	for(vector<Intermediate_record>::const_iterator j = i->second.records.begin(); j < i->second.records.end(); ++j)
+		buf.print_record(*j);
+	buf.finish_query_record();
+	master_out.stream().write(buf.get_begin(), buf.size());
+	buf.clear();
+	statistics.inc(Statistics::MATCHES, (stat_type)i->second.records.size());
+	statistics.inc(Statistics::PAIRWISE, i->second.pairwise);
+	if(--i->second.pending == 0)
+		copies.erase(i);
+}
+
+/* Writes the records of a query found in the result cache. The subjects of
+cache entries are stored by name and length. */
+void write_cached(unsigned query, Binary_buffer::Iterator it, Output_buffer &buf, Master_output &master_out)
+{
+	uint32_t n, length, subject = std::numeric_limits<uint32_t>::max();
+	it >> n;
+	if(n == 0)
+		return;
+	Intermediate_record r;
+	string name;
+	statistics.inc(Statistics::ALIGNED);
+	buf.write_query_record(query);
+	for(uint32_t i=0;i<n;++i) {
+		it >> name >> length >> r.flag;
+		it.read_packed(r.flag & 3, r.score);
+		it.read_packed((r.flag >> 2) & 3, r.query_begin);
+		it.read_packed((r.flag >> 4) & 3, r.subject_begin);
+		r.transcript.read(it);
+		r.subject_id = ref_map.get(name, length);
+		buf.print_record(r);
+		if(r.subject_id != subject) {
+			subject = r.subject_id;
+			statistics.inc(Statistics::PAIRWISE);
+		}
+	}
+	buf.finish_query_record();
+	master_out.stream().write(buf.get_begin(), buf.size());
+	buf.clear();
+	statistics.inc(Statistics::MATCHES, n);
+}
+
+/* Stores the output records of a searched query in the result cache. */
+void cache_records(unsigned query, const vector<Intermediate_record> &records)
+{
+	Text_buffer buf;
+	buf.write((uint32_t)records.size());
+	for(vector<Intermediate_record>::const_iterator i = records.begin(); i < records.end(); ++i) {
+		buf.write_c_str(ref_map.name(i->subject_id));
+		buf.write(ref_map.length(i->subject_id)).write(i->flag);
+		buf.write_packed(i->score);
+		buf.write_packed(i->query_begin);
+		buf.write_packed(i->subject_begin);
+		buf << i->transcript.data();
+	}
+	Result_cache::instance->insert(query, buf.get_begin(), buf.size());
+}
+
+/* Queries of the chunk that were not searched: the duplicates of
+deduplicated queries and the queries found in the result cache. They are
+written in query order in between the searched queries. */
+struct Skipped_queries
+{
+	Skipped_queries(Output_buffer &buf, Master_output &master_out):
+		buf_ (buf),
+		master_out_ (master_out)
+	{
+		if(Query_dedup::instance) {
+			dup_ = Query_dedup::instance->duplicates().begin();
+			dup_end_ = Query_dedup::instance->duplicates().end();
+		}
+		if(Cached_queries::instance) {
+			hit_ = Cached_queries::instance->hits().begin();
+			hit_end_ = Cached_queries::instance->hits().end();
+		}
+	}
+
+	/* Writes the skipped queries preceding the given chunk query number. */
+	void write(unsigned limit)
+	{
+		const unsigned none = std::numeric_limits<unsigned>::max();
+		for(;;) {
+			const unsigned d = Query_dedup::instance && dup_ < dup_end_ ? chunk_query(dup_->first) : none,
+				h = Cached_queries::instance && hit_ < hit_end_ ? hit_->first : none;
+			if(std::min(d, h) >= limit)
+				break;
+			if(d < h)
+				write_duplicate(dup_++, copies, buf_, master_out_);
+			else {
+				write_cached(hit_->first, Result_cache::instance->payload(hit_->second), buf_, master_out_);
+				++hit_;
+			}
+		}
+	}
+
+	std::map<unsigned,Query_copies> copies;
+
+private:
+
+	Output_buffer &buf_;
+	Master_output &master_out_;
+	vector<pair<unsigned,unsigned> >::const_iterator dup_, dup_end_;
+	vector<pair<unsigned,size_t> >::const_iterator hit_, hit_end_;
+
+};
+
+/* Merges the temporary outputs of the reference blocks. If queries were
+deduplicated or found in the result cache, the query sets must have been
+swapped back to the full ones; the records of the representatives are then
+repeated for their duplicates and the cached records are inserted. With a
+result cache, the records of the searched queries are added to it. */
+void join_blocks(unsigned ref_blocks, Master_output &master_out, const vector<Temp_file> &tmp_file, vector<vector<Block_chunk> > &tmp_chunks)
 {
 	vector<Block_output*> files;
 	vector<Block_output::Iterator> records;
 	Block_output::Iterator r;
 	for(unsigned i=0;i<ref_blocks;++i) {
-		files.push_back(new Block_output (i, tmp_file[i]));
+		if(config.unordered_output)
+			files.push_back(new Block_output (i, sort_block_chunks(tmp_file[i], tmp_chunks[i])));
+		else
+			files.push_back(new Block_output (i, tmp_file[i]));
 		if(files.back()->next(r, std::numeric_limits<unsigned>::max(), std::numeric_limits<unsigned>::max()))
 			records.push_back(r);
 	}
 	std::make_heap(records.begin(), records.end());
-	unsigned query, block, subject, n_target_seq = 0;
-	query = block = subject = std::numeric_limits<unsigned>::max();
+	unsigned query, output_query, block, subject, n_target_seq = 0;
+	query = output_query = block = subject = std::numeric_limits<unsigned>::max();
 	int top_score=0;
-	Output_buffer buf;
+	auto_ptr<Output_buffer> out (direct_output() ? new Text_output_buffer : new Output_buffer);
+	Output_buffer &buf = *out;
+	const Query_dedup *dedup = Query_dedup::instance;
+	Skipped_queries skipped (buf, master_out);
+	Query_copies *query_copies = 0;
+	const unsigned searched = dedup ? dedup->size()
+		: (Cached_queries::instance ? Cached_queries::instance->searched() : (unsigned)query_ids::get().get_length());
+	vector<bool> written (Result_cache::instance ? searched : 0);
+	vector<Intermediate_record> cache_rec;
 	while(!records.empty()) {
 		const Block_output::Iterator &next = records.front();
 		const unsigned b = next.block_;
@@ -54,23 +229,42 @@ void join_blocks(unsigned ref_blocks, DAA_output &master_out, const vector<Temp_
 				buf.finish_query_record();
 				master_out.stream().write(buf.get_begin(), buf.size());
 				buf.clear();
+				if(Result_cache::instance)
+					cache_records(output_query, cache_rec);
 			}
 			query = next.info_.query_id;
+			output_query = chunk_query(dedup ? dedup->original(query) : query);
 			n_target_seq = 0;
 			top_score = next.info_.score;
+			query_copies = 0;
+			cache_rec.clear();
+			if(Result_cache::instance)
+				written[query] = true;
+			skipped.write(output_query);
+			if(dedup && dedup->copies(query) > 0) {
+				query_copies = &skipped.copies[query];
+				query_copies->pending = dedup->copies(query);
+				query_copies->pairwise = 0;
+			}
 			statistics.inc(Statistics::ALIGNED);
-			buf.write_query_record(query);
+			buf.write_query_record(output_query);
 		}
 		const bool same_subject = n_target_seq > 0 && b == block && next.info_.subject_id == subject;
 		if(config.output_range(n_target_seq, next.info_.score, top_score) || same_subject) {
 			//printf("q=%u s=%u n=%u ss=%u\n",query, next.info_.subject_id, n_target_seq, same_subject, next.info_.score);
-			DAA_output::write_record(buf, next.info_);
+			buf.print_record(next.info_);
 			statistics.inc(Statistics::MATCHES);
+			if(query_copies)
+				query_copies->records.push_back(next.info_);
+			if(Result_cache::instance)
+				cache_rec.push_back(next.info_);
 			if(!same_subject) {
 				block = b;
 				subject = next.info_.subject_id;
 				++n_target_seq;
 				statistics.inc(Statistics::PAIRWISE);
+				if(query_copies)
+					++query_copies->pairwise;
 			}
 		} else
 			;
@@ -85,7 +279,15 @@ void join_blocks(unsigned ref_blocks, DAA_output &master_out, const vector<Temp_
 	if(query != std::numeric_limits<unsigned>::max()) {
 		buf.finish_query_record();
 		master_out.stream().write(buf.get_begin(), buf.size());
+		buf.clear();
+		if(Result_cache::instance)
+			cache_records(output_query, cache_rec);
 	}
+	skipped.write(std::numeric_limits<unsigned>::max());
+	cache_rec.clear();
+	for(unsigned i=0;i<written.size();++i)
+		if(!written[i])
+			cache_records(chunk_query(dedup ? dedup->original(i) : i), cache_rec);
 	for(unsigned i=0;i<ref_blocks;++i) {
 		files[i]->close_and_delete();
 		delete files[i];
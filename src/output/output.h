@@ -21,4 +21,28 @@ struct Intermediate_record
 	Packed_transcript transcript;
 };
 
+/* Final output of a search run. */
+struct Master_output
+{
+	virtual Output_stream& stream() = 0;
+	virtual void finish() = 0;
+	virtual ~Master_output()
+	{ }
+};
+
+/* Location of one output slot within a temporary block output file. Used to
+restore query order when the slots have been written in completion order. */
+struct Block_chunk
+{
+	Block_chunk(unsigned query, size_t offset, size_t size):
+		query (query),
+		offset (offset),
+		size (size)
+	{ }
+	bool operator<(const Block_chunk &rhs) const
+	{ return query < rhs.query; }
+	unsigned query;
+	size_t offset, size;
+};
+
 #endif
\ No newline at end of file
@@ -45,6 +45,9 @@ struct Output_buffer : public Text_buffer
 		const sequence &query,
 		unsigned query_id)
 	{ DAA_output::write_record(*this, match, query_source_len, query, query_id); }
+	/* Writes a record of a joined block output. */
+	virtual void print_record(const Intermediate_record &r)
+	{ DAA_output::write_record(*this, r); }
 	virtual void write_query_record(unsigned query_id)
 	{
 		query_begin_ = this->size();
@@ -55,6 +58,8 @@ struct Output_buffer : public Text_buffer
 	}
 	virtual void finish_query_record()
 	{ *(uint32_t*)(this->data_+query_begin_) = (uint32_t)(this->size() - query_begin_ - sizeof(uint32_t)); }
+	virtual unsigned first_query() const
+	{ return 0; }
 	virtual ~Output_buffer()
 	{ }
 private:
@@ -69,11 +74,95 @@ struct Temp_output_buffer : public Output_buffer
 				unsigned query_id)
 	{ write_intermediate_record(*this, match, query_source_len, query, query_id); }
 	virtual void write_query_record(unsigned query_id)
-	{ }
+	{
+		if (this->size() == 0)
+			first_query_ = query_id;
+	}
 	virtual void finish_query_record()
 	{ }
+	virtual unsigned first_query() const
+	{ return first_query_; }
 	virtual ~Temp_output_buffer()
 	{ }
+private:
+	unsigned first_query_;
+};
+
+/* Formats alignments in the chosen output format instead of writing DAA
+records. HSPs are decoded from the same fields a DAA record stores, so the
+output equals that of the view command. */
+struct Text_output_buffer : public Output_buffer
+{
+	Text_output_buffer():
+		format_ (get_output_format())
+	{ }
+	virtual void print_match(const Segment &match,
+		size_t query_source_len,
+		const sequence &query,
+		unsigned query_id)
+	{
+		const char *name = ref_ids::get()[match.subject_id_].c_str();
+		if(!config.salltitles) {
+			subject_name_.assign(name, find_first_of(name, Const::id_delimiters));
+			name = subject_name_.c_str();
+		}
+		hsp_.score = match.score_;
+		hsp_.subject_range.begin_ = match.traceback_->subject_range.begin_;
+		hsp_.transcript = match.traceback_->transcript;
+		print(match.subject_id_, name, (unsigned)ref_seqs::get().length(match.subject_id_), match.traceback_->oriented_range().begin_, get_rev_flag(match.frame_) != 0);
+	}
+	virtual void print_record(const Intermediate_record &r)
+	{
+		hsp_.score = r.score;
+		hsp_.subject_range.begin_ = r.subject_begin;
+		hsp_.transcript = r.transcript;
+		print(r.subject_id, ref_map.name(r.subject_id), ref_map.length(r.subject_id), r.query_begin, (r.flag & (1 << 6)) != 0);
+	}
+	virtual void write_query_record(unsigned query_id)
+	{
+		const char *name = query_ids::get()[query_id].c_str();
+		query_name_.assign(name, find_first_of(name, Const::id_delimiters));
+		unsigned query_len;
+		if(align_mode.query_translated) {
+			const sequence seq = query_source_seqs::get()[query_id];
+			source_seq_.assign(seq.data(), seq.data() + seq.length());
+			for(unsigned i=0;i<6;++i)
+				context_[i].clear();
+			if(format_.needs_query_seq())
+				translate_query(source_seq_, context_);
+			query_len = (unsigned)source_seq_.size();
+		} else {
+			const sequence seq = query_seqs::get()[query_id];
+			context_[0].assign(seq.data(), seq.data() + seq.length());
+			query_len = (unsigned)seq.length();
+		}
+		subject_ = hit_num_ = std::numeric_limits<unsigned>::max();
+		format_.print_query_intro(current_query_offset + query_id, query_name_.c_str(), query_len, *this);
+	}
+	virtual void finish_query_record()
+	{ format_.print_query_epilog(*this); }
+	virtual ~Text_output_buffer()
+	{ }
+private:
+	void print(unsigned subject, const char *subject_name, unsigned subject_len, unsigned query_begin, bool reverse)
+	{
+		if(subject == subject_)
+			++hsp_num_;
+		else {
+			subject_ = subject;
+			hsp_num_ = 0;
+			++hit_num_;
+		}
+		decode_hsp(hsp_, align_mode.mode, query_begin, reverse, source_seq_, context_);
+		if(hsp_.frame > 2 && config.forwardonly)
+			return;
+		format_.print_match(Hsp_context(hsp_, query_frame(source_seq_, context_, hsp_.frame), query_name_.c_str(), subject, subject_name, subject_len, hit_num_, hsp_num_), *this);
+	}
+	const Output_format &format_;
+	string query_name_, subject_name_;
+	vector<Letter> source_seq_, context_[6];
+	Hsp_data hsp_;
+	unsigned subject_, hit_num_, hsp_num_;
 };
 
 #endif /* OUTPUT_BUFFER_H_ */
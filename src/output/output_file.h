@@ -38,7 +38,8 @@ struct Block_output : public Buffered_file
 		bool operator<(const Iterator &rhs) const
 		{ return info_.query_id > rhs.info_.query_id ||
 				(info_.query_id == rhs.info_.query_id && (rhs.same_subject_ ||
-						(!rhs.same_subject_ && info_.score < rhs.info_.score))); }
+						(!rhs.same_subject_ && (info_.score < rhs.info_.score
+								|| (info_.score == rhs.info_.score && block_ > rhs.block_))))); }
 	};
 
 	bool next(Iterator &it, unsigned subject, unsigned query)
@@ -17,6 +17,7 @@ LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR P
 ****/
 
 #include <iostream>
+#include <sstream>
 #include "output_format.h"
 #include "../data/reference.h"
 
@@ -57,20 +58,19 @@ void XML_format::print_match(const Hsp_context &r, Text_buffer &out) const
 		<< "      <Hsp_align-len>" << r.length() << "</Hsp_align-len>" << '\n'
 		<< "         <Hsp_qseq>";
 
-	for (Hsp_context::Iterator i = r.begin(); i.good(); ++i)
-		out << i.query_char();
-		
-	out << "</Hsp_qseq>" << '\n'
-		<< "         <Hsp_hseq>";
-
-	for (Hsp_context::Iterator i = r.begin(); i.good(); ++i)
-		out << i.subject_char();
-
-	out << "</Hsp_hseq>" << '\n'
-		<< "      <Hsp_midline>";
-
-	for (Hsp_context::Iterator i = r.begin(); i.good(); ++i)
-		out << i.midline_char();
+	static const char hseq_tag[] = "</Hsp_qseq>\n         <Hsp_hseq>",
+		midline_tag[] = "</Hsp_hseq>\n      <Hsp_midline>";
+	const size_t len = r.length(), hseq_offset = len + sizeof(hseq_tag) - 1, midline_offset = hseq_offset + len + sizeof(midline_tag) - 1;
+	out.reserve(midline_offset + len);
+	char *q = out, *s = q + hseq_offset, *m = q + midline_offset;
+	memcpy(q + len, hseq_tag, sizeof(hseq_tag) - 1);
+	memcpy(s + len, midline_tag, sizeof(midline_tag) - 1);
+	for (Hsp_context::Iterator i = r.begin(); i.good(); ++i) {
+		*(q++) = i.query_char();
+		*(s++) = i.subject_char();
+		*(m++) = i.midline_char();
+	}
+	out += midline_offset + len;
 
 	out << "</Hsp_midline>" << '\n'
 		<< "    </Hsp>" << '\n';
@@ -102,17 +102,17 @@ void XML_format::print_header(Output_stream &f, int mode, const char *matrix, in
 	f.write(ss.str().c_str(), ss.str().length());
 }
 
-void XML_format::print_query_intro(const DAA_query_record &r, Text_buffer &out) const
+void XML_format::print_query_intro(size_t query_num, const char *query_name, unsigned query_len, Text_buffer &out) const
 {
 	out << "<Iteration>" << '\n'
-		<< "  <Iteration_iter-num>" << r.query_num+1 << "</Iteration_iter-num>" << '\n'
-		<< "  <Iteration_query-ID>Query_" << r.query_num+1 << "</Iteration_query-ID>" << '\n'
-		<< "  <Iteration_query-def>" << r.query_name << "</Iteration_query-def>" << '\n'
-		<< "  <Iteration_query-len>" << r.query_len() << "</Iteration_query-len>" << '\n'
+		<< "  <Iteration_iter-num>" << query_num+1 << "</Iteration_iter-num>" << '\n'
+		<< "  <Iteration_query-ID>Query_" << query_num+1 << "</Iteration_query-ID>" << '\n'
+		<< "  <Iteration_query-def>" << query_name << "</Iteration_query-def>" << '\n'
+		<< "  <Iteration_query-len>" << query_len << "</Iteration_query-len>" << '\n'
 		<< "<Iteration_hits>" << '\n';
 }
 
-void XML_format::print_query_epilog(const DAA_query_record &r, Text_buffer &out) const
+void XML_format::print_query_epilog(Text_buffer &out) const
 {
 	((out << "  </Hit_hsps>" << '\n'
 		<< "</Hit>" << '\n'
@@ -138,3 +138,133 @@ void XML_format::print_footer(Output_stream &f) const
 		<< "</BlastOutput>";
 	f.write(ss.str().c_str(), ss.str().length());
 }
+
+static void write_int_tag(Text_buffer &out, const char *tag, int64_t x)
+{
+	out << tag[0] << tag[1];
+	if (x < 0) {
+		if (x >= std::numeric_limits<int8_t>::min())
+			out << 'c' << (char)x;
+		else if (x >= std::numeric_limits<int16_t>::min())
+			out.write((char)'s').write((int16_t)x);
+		else
+			out.write((char)'i').write((int32_t)x);
+	}
+	else if (x <= std::numeric_limits<uint8_t>::max())
+		out.write((char)'C').write((uint8_t)x);
+	else if (x <= std::numeric_limits<uint16_t>::max())
+		out.write((char)'S').write((uint16_t)x);
+	else
+		out.write((char)'I').write((uint32_t)x);
+}
+
+static unsigned reg2bin(unsigned begin, unsigned end)
+{
+	--end;
+	for (unsigned shift = 14, offset = ((1 << 15) - 1) / 7; shift < 29; shift += 3, offset = (offset - 1) / 8)
+		if (begin >> shift == end >> shift)
+			return offset + (begin >> shift);
+	return 0;
+}
+
+struct Bam_cigar_writer
+{
+	Bam_cigar_writer(Text_buffer &buf):
+		buf (buf),
+		n (0)
+	{ }
+	void operator()(unsigned count, unsigned op)
+	{
+		buf.write((uint32_t)(count << 4 | op));
+		++n;
+	}
+	Text_buffer &buf;
+	unsigned n;
+};
+
+void Bam_format::print_match(const Hsp_context& r, Text_buffer &out) const
+{
+	const size_t begin = out.size(), name_len = std::min(strlen(r.query_name), (size_t)254);
+	out.write((int32_t)0)
+		.write((int32_t)r.subject_id)
+		.write((int32_t)r.subject_range().begin_)
+		.write((uint8_t)(name_len + 1))
+		.write((uint8_t)255)
+		.write((uint16_t)reg2bin(r.subject_range().begin_, r.subject_range().end_))
+		.write((uint16_t)0)
+		.write((uint16_t)0)
+		.write((int32_t)0)
+		.write((int32_t)-1)
+		.write((int32_t)-1)
+		.write((int32_t)0);
+	out.write_c_str(r.query_name, name_len);
+
+	Text_buffer &md = get_md_buffer();
+	Bam_cigar_writer cigar (out);
+	print_cigar_md(r, cigar, md);
+	*(uint16_t*)(out.get_begin() + begin + 16) = (uint16_t)cigar.n;
+
+	write_int_tag(out, "AS", (uint32_t)score_matrix.bitscore(r.score()));
+	write_int_tag(out, "NM", r.length() - r.identities());
+	write_int_tag(out, "ZL", r.subject_len);
+	write_int_tag(out, "ZR", r.score());
+	out << 'Z' << 'E' << 'f';
+	out.write((float)score_matrix.evalue(r.score(), config.db_size, (unsigned)r.query.length()));
+	write_int_tag(out, "ZI", r.identities() * 100 / r.length());
+	write_int_tag(out, "ZF", blast_frame(r.frame()));
+	write_int_tag(out, "ZS", r.oriented_query_range().begin_ + 1);
+	out << 'M' << 'D' << 'Z';
+	out.write_c_str(md.get_begin(), md.size());
+	out << 'Z' << 'Q' << 'Z';
+	const Letter *query = &r.query[r.query_range().begin_];
+	for (unsigned i = 0; i < r.query_range().length(); ++i)
+		out << value_traits.alphabet[(long)query[i]];
+	out << '\0';
+
+	*(int32_t*)(out.get_begin() + begin) = (int32_t)(out.size() - begin - sizeof(int32_t));
+}
+
+/* Reference name as printed by the SAM format. */
+static string sam_ref_name(const string &id)
+{
+	string s;
+	for (string::const_iterator i = id.begin(); i != id.end(); ++i)
+		if (*i == '\1')
+			s += "<>";
+		else
+			s += *i;
+	return s;
+}
+
+void Bam_format::write_header(Output_stream &f, const DAA_file &daa)
+{
+	std::stringstream text;
+	text << header_text(daa.mode())
+		<< "@CO\tSEQ is empty, ZQ: aligned query protein sequence\n";
+	for (size_t i = 0; i < daa.db_seqs_used(); ++i)
+		text << "@SQ\tSN:" << sam_ref_name(daa.ref_name(i)) << "\tLN:" << daa.ref_len(i) << '\n';
+
+	Text_buffer buf, out;
+	buf.write_raw("BAM\1", 4);
+	buf.write((int32_t)text.str().length());
+	buf << text.str();
+	buf.write((int32_t)daa.db_seqs_used());
+	for (size_t i = 0; i < daa.db_seqs_used(); ++i) {
+		const string name = sam_ref_name(daa.ref_name(i));
+		buf.write((int32_t)(name.length() + 1));
+		buf.write_c_str(name.c_str(), name.length());
+		buf.write((int32_t)daa.ref_len(i));
+	}
+	Bgzf::compress(buf.get_begin(), buf.size(), out);
+	f.write(out.get_begin(), out.size());
+}
+
+void Bam_format::finish_buffer(Text_buffer &buf) const
+{
+	static TLS_PTR Text_buffer *out_ptr;
+	Text_buffer &out = get_tls(out_ptr);
+	out.clear();
+	Bgzf::compress(buf.get_begin(), buf.size(), out);
+	buf.clear();
+	buf.write_raw(out.get_begin(), out.size());
+}
@@ -26,18 +26,28 @@ LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR P
 #include "../output/daa_record.h"
 #include "../util/compressed_stream.h"
 #include "../basic/score_matrix.h"
+#include "../util/bgzf.h"
+#include "hit_table.h"
 
 struct Output_format
 {
-	virtual void print_query_intro(const DAA_query_record &r, Text_buffer &out) const
+	virtual void print_query_intro(size_t query_num, const char *query_name, unsigned query_len, Text_buffer &out) const
 	{}
-	virtual void print_query_epilog(const DAA_query_record &r, Text_buffer &out) const
+	virtual void print_query_epilog(Text_buffer &out) const
 	{}
 	virtual void print_match(const Hsp_context& r, Text_buffer &out) const = 0;
 	virtual void print_header(Output_stream &f, int mode, const char *matrix, int gap_open, int gap_extend, double evalue, const char *first_query_name, unsigned first_query_len) const
 	{ }
 	virtual void print_footer(Output_stream &f) const
 	{ }
+	/* Called by the formatting thread on a filled output buffer before it is
+	passed to the writer. */
+	virtual void finish_buffer(Text_buffer &buf) const
+	{ }
+	/* Whether print_match accesses the query sequence or the positives
+	count. */
+	virtual bool needs_query_seq() const
+	{ return true; }
 	virtual ~Output_format()
 	{ }
 	static size_t print_salltitles(Text_buffer &buf, const char *id)
@@ -84,6 +94,9 @@ struct Blast_tab_format : public Output_format
 		out << '\t' << r.bit_score() << '\n';
 	}
 
+	virtual bool needs_query_seq() const
+	{ return false; }
+
 	virtual ~Blast_tab_format()
 	{ }
 
@@ -106,7 +119,9 @@ struct Sam_format : public Output_format
 			<< r.subject_range().begin_ + 1 << '\t'
 			<< "255" << '\t';
 
-		print_cigar(r, out);
+		Text_buffer &md = get_md_buffer();
+		Cigar_writer cigar (out);
+		print_cigar_md(r, cigar, md);
 
 		out << '\t'
 			<< '*' << '\t'
@@ -126,14 +141,26 @@ struct Sam_format : public Output_format
 			<< "ZS:i:" << r.oriented_query_range().begin_ + 1 << '\t'
 			<< "MD:Z:";
 
-		print_md(r, out);
+		out.write_raw(md.get_begin(), md.size());
 		out << '\n';
 	}
 
-	void print_md(const Hsp_context &r, Text_buffer &buf) const
+	/* Passes the CIGAR operations (0=M, 1=I, 2=D) to cigar and writes the MD
+	string to md in one pass over the transcript. */
+	template<typename _cigar>
+	static void print_cigar_md(const Hsp_context &r, _cigar &cigar, Text_buffer &md)
 	{
-		unsigned matches = 0, del = 0;
+		static const unsigned map[] = { 0, 1, 2, 0 };
+		unsigned n = 0, op = 0, matches = 0, del = 0;
 		for(Packed_transcript::Const_iterator i = r.begin_old(); i.good(); ++i) {
+			if(map[i->op] == op)
+				n += i->count;
+			else {
+				if(n > 0)
+					cigar(n, op);
+				n = i->count;
+				op = map[i->op];
+			}
 			switch(i->op) {
 			case op_match:
 				del = 0;
@@ -143,56 +170,65 @@ struct Sam_format : public Output_format
 				break;
 			case op_substitution:
 				if(matches > 0) {
-					buf << matches;
+					md << matches;
 					matches = 0;
 				} else if(del > 0) {
-					buf << '0';
+					md << '0';
 					del = 0;
 				}
-				buf << value_traits.alphabet[(long)i->letter];
+				md << value_traits.alphabet[(long)i->letter];
 				break;
 			case op_deletion:
 				if(matches > 0) {
-					buf << matches;
+					md << matches;
 					matches = 0;
 				}
 				if(del == 0)
-					buf << '^';
-				buf << value_traits.alphabet[(long)i->letter];
+					md << '^';
+				md << value_traits.alphabet[(long)i->letter];
 				++del;
 			}
 		}
+		if(n > 0)
+			cigar(n, op);
 		if(matches > 0)
-			buf << matches;
+			md << matches;
 	}
 
-	void print_cigar(const Hsp_context &r, Text_buffer &buf) const
+	struct Cigar_writer
 	{
-		static const unsigned map[] = { 0, 1, 2, 0 };
-		static const char letter[] = { 'M', 'I', 'D' };
-		unsigned n = 0, op = 0;
-		for(Packed_transcript::Const_iterator i = r.begin_old(); i.good(); ++i) {
-			if(map[i->op] == op)
-				n += i->count;
-			else {
-				if(n > 0)
-					buf << n << letter[op];
-				n = i->count;
-				op = map[i->op];
-			}
-		}
-		if(n > 0)
+		Cigar_writer(Text_buffer &buf):
+			buf (buf)
+		{ }
+		void operator()(unsigned n, unsigned op)
+		{
+			static const char letter[] = { 'M', 'I', 'D' };
 			buf << n << letter[op];
+		}
+		Text_buffer &buf;
+	};
+
+	static Text_buffer& get_md_buffer()
+	{
+		static TLS_PTR Text_buffer *md_ptr;
+		Text_buffer &md = get_tls(md_ptr);
+		md.clear();
+		return md;
 	}
 
-	virtual void print_header(Output_stream &f, int mode, const char *matrix, int gap_open, int gap_extend, double evalue, const char *first_query_name, unsigned first_query_len) const
+	static string header_text(int mode)
 	{
 		static const char* mode_str[] = { 0, 0, "BlastP", "BlastX", "BlastN" };
-		string line = string("@HD\tVN:1.5\tSO:query\n\
+		return string("@HD\tVN:1.5\tSO:query\n\
 @PG\tPN:DIAMOND\n\
 @mm\t") + mode_str[mode] + "\n\
 @CO\t" + mode_str[mode] + "-like alignments\n\
 @CO\tReporting AS: bitScore, ZR: rawScore, ZE: expected, ZI: percent identity, ZL: reference length, ZF: frame, ZS: query start DNA coordinate\n";
+	}
+
+	virtual void print_header(Output_stream &f, int mode, const char *matrix, int gap_open, int gap_extend, double evalue, const char *first_query_name, unsigned first_query_len) const
+	{
+		const string line = header_text(mode);
 		f.write(line.c_str(), line.length());
 	}
 
@@ -201,32 +237,121 @@ struct Sam_format : public Output_format
 
 };
 
+/* Binary SAM. Records carry the same fields and tags as the SAM output,
+except that SEQ is empty since the 4-bit BAM alphabet cannot hold protein
+letters; the aligned query sequence is stored in the ZQ tag instead. Each
+filled output buffer is BGZF-compressed by the thread that formatted it, so
+the ordered writer only concatenates blocks. */
+struct Bam_format : public Sam_format
+{
+
+	Bam_format()
+	{ }
+
+	virtual void print_match(const Hsp_context& r, Text_buffer &out) const;
+
+	virtual void print_header(Output_stream &f, int mode, const char *matrix, int gap_open, int gap_extend, double evalue, const char *first_query_name, unsigned first_query_len) const
+	{ }
+
+	/* Writes the BAM header, using the references of the DAA file as the
+	reference dictionary. */
+	static void write_header(Output_stream &f, const DAA_file &daa);
+
+	virtual void print_footer(Output_stream &f) const
+	{ Bgzf::write_eof(f); }
+
+	virtual void finish_buffer(Text_buffer &buf) const;
+
+	virtual ~Bam_format()
+	{ }
+
+};
+
 struct XML_format : public Output_format
 {
 	XML_format()
 	{}
 	virtual void print_match(const Hsp_context &r, Text_buffer &out) const;
 	virtual void print_header(Output_stream &f, int mode, const char *matrix, int gap_open, int gap_extend, double evalue, const char *first_query_name, unsigned first_query_len) const;
-	virtual void print_query_intro(const DAA_query_record &r, Text_buffer &out) const;
-	virtual void print_query_epilog(const DAA_query_record &r, Text_buffer &out) const;
+	virtual void print_query_intro(size_t query_num, const char *query_name, unsigned query_len, Text_buffer &out) const;
+	virtual void print_query_epilog(Text_buffer &out) const;
 	virtual void print_footer(Output_stream &f) const;
 	virtual ~XML_format()
 	{ }
 };
 
+/* Columns of the tabular format for the binary hit table. The records are
+stored by Hit_table_ostream, which open_text_output() selects for this
+format. */
+struct Hit_table_format : public Output_format
+{
+
+	Hit_table_format()
+	{ }
+
+	virtual void print_query_intro(size_t query_num, const char *query_name, unsigned query_len, Text_buffer &out) const
+	{
+		out << Hit_table::record_query;
+		out.write((uint32_t)query_num);
+		Hit_table::write_name(out, query_name, strlen(query_name));
+	}
+
+	virtual void print_match(const Hsp_context& r, Text_buffer &out) const
+	{
+		Hit_table::Row row;
+		row.subject = r.subject_id;
+		row.identity = (float)((double)r.identities() * 100 / r.length());
+		row.length = r.length();
+		row.mismatches = r.mismatches();
+		row.gap_openings = r.gap_openings();
+		row.query_start = r.oriented_query_range().begin_ + 1;
+		row.query_end = r.oriented_query_range().end_ + 1;
+		row.subject_start = r.subject_range().begin_ + 1;
+		row.subject_end = r.subject_range().end_;
+		row.evalue = r.evalue();
+		row.bit_score = (float)r.bit_score();
+		out << Hit_table::record_hit;
+		out.write(row);
+		const size_t begin = out.size();
+		out.write((uint32_t)0);
+		print_salltitles(out, r.subject_name);
+		const uint32_t l = (uint32_t)(out.size() - begin - sizeof(uint32_t));
+		memcpy(out.get_begin() + begin, &l, sizeof(l));
+	}
+
+	virtual bool needs_query_seq() const
+	{ return false; }
+
+	virtual ~Hit_table_format()
+	{ }
+
+};
+
+/* Without a DAA file, the aligner writes the chosen output format directly. */
+inline bool direct_output()
+{
+	return config.daa_file.empty();
+}
+
 inline const Output_format& get_output_format()
 {
 	static const Sam_format sam;
 	static const Blast_tab_format tab;
 	static const XML_format xml;
+	static const Bam_format bam;
+	static const Hit_table_format hits;
 	if(config.output_format == "tab")
 		return tab;
 	else if (config.output_format == "sam")
 		return sam;
 	else if (config.output_format == "xml")
 		return xml;
+	else if (config.output_format == "bam")
+		return bam;
+	else if (config.output_format == "hits")
+		return hits;
 	else
-		throw std::runtime_error("Invalid output format. Allowed values: tab,sam,xml");
+		throw std::runtime_error("Invalid output format. Allowed values: tab,sam,xml,bam,hits");
 	return tab;
 }
 
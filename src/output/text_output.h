@@ -0,0 +1,63 @@
+/****
+Copyright (c) 2016, University of Tuebingen, Benjamin Buchfink
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification, are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this list of conditions and the following disclaimer.
+
+2. Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the following disclaimer in the documentation and/or other materials provided with the distribution.
+
+3. Neither the name of the copyright holder nor the names of its contributors may be used to endorse or promote products derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+****/
+
+#ifndef TEXT_OUTPUT_H_
+#define TEXT_OUTPUT_H_
+
+#include <memory>
+#include "../basic/config.h"
+#include "../util/compressed_stream.h"
+#include "../basic/score_matrix.h"
+#include "output.h"
+#include "output_format.h"
+
+inline Output_stream* open_text_output()
+{
+	if (config.output_format == "hits")
+		return new Hit_table_ostream(config.output_file);
+	return config.compression == 1 && config.output_format != "bam"
+		? new Compressed_ostream(config.output_file + ".gz")
+		: new Output_stream(config.output_file);
+}
+
+/* Formatted output of the aligner, written to the output file or stdout. */
+struct Text_output : public Master_output
+{
+
+	Text_output():
+		f_ (open_text_output())
+	{
+		get_output_format().print_header(*f_, align_mode.mode, config.matrix.c_str(), config.gap_open, config.gap_extend, config.max_evalue, "", 0);
+	}
+
+	virtual Output_stream& stream()
+	{ return *f_; }
+
+	virtual void finish()
+	{
+		get_output_format().print_footer(*f_);
+		f_->close();
+	}
+
+private:
+
+	auto_ptr<Output_stream> f_;
+
+};
+
+#endif /* TEXT_OUTPUT_H_ */
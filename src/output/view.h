@@ -28,15 +28,14 @@ LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR P
 #include "../util/task_queue.h"
 #include "../basic/score_matrix.h"
 #include "../util/thread.h"
+#include "text_output.h"
 
 const unsigned view_buf_size = 32;
 
 struct View_writer
 {
 	View_writer():
-		f_ (config.compression == 1
-			? new Compressed_ostream(config.output_file + ".gz")
-			: new Output_stream(config.output_file))
+		f_ (open_text_output())
 	{ }
 	void operator()(Text_buffer &buf)
 	{
@@ -50,15 +49,27 @@ struct View_writer
 	auto_ptr<Output_stream> f_;
 };
 
+/* Fetches the next query records. Compressed blocks are only read here and
+decompressed by decompress() outside of the queue lock. */
 struct View_fetcher
 {
 	View_fetcher(DAA_file &daa):
+		buf (view_buf_size),
 		daa (daa)
 	{ }
 	bool operator()()
 	{
 		n = 0;
-		for(unsigned i=0;i<view_buf_size;++i)
+		if (daa.compressed() && !daa.pending()) {
+			if (!daa.read_block(block)) {
+				block.header.records = 0;
+				return false;
+			}
+			query_num = block.query_num;
+			return true;
+		}
+		block.header.records = 0;
+		for(unsigned i=0;i<view_buf_size && !(daa.compressed() && !daa.pending());++i)
 			if (!daa.read_query_buffer(buf[i], query_num)) {
 				query_num -= n - 1;
 				return false;
@@ -67,21 +78,34 @@ struct View_fetcher
 		query_num -= n - 1;
 		return true;
 	}
-	Binary_buffer buf[view_buf_size];
+	void decompress()
+	{
+		if (block.header.records == 0)
+			return;
+		block.decompress(block_data);
+		if (buf.size() < block.header.records)
+			buf.resize(block.header.records);
+		size_t pos = 0;
+		for (n = 0; n < block.header.records; ++n)
+			DAA_block::get_record(block_data, pos, buf[n]);
+	}
+	vector<Binary_buffer> buf;
 	unsigned n;
 	size_t query_num;
+	DAA_block block;
+	vector<char> block_data;
 	DAA_file &daa;
 };
 
 void view_query(DAA_query_record &r, Text_buffer &out, const Output_format &format)
 {
-	format.print_query_intro(r, out);
+	format.print_query_intro(r.query_num, r.query_name.c_str(), (unsigned)r.query_len(), out);
 	for (DAA_query_record::Match_iterator i = r.begin(); i.good(); ++i) {
 		if (i->frame > 2 && config.forwardonly)
 			continue;
 		format.print_match(i->context(), out);
 	}
-	format.print_query_epilog(r, out);
+	format.print_query_epilog(out);
 }
 
 struct View_context
@@ -99,10 +123,12 @@ struct View_context
 			View_fetcher query_buf (daa);
 			Text_buffer *buffer = 0;
 			while(queue.get(n, buffer, query_buf)) {
+				query_buf.decompress();
 				for (unsigned j = 0; j < query_buf.n; ++j) {
-					DAA_query_record r(daa, query_buf.buf[j], query_buf.query_num + j);
+					DAA_query_record r(daa, query_buf.buf[j], query_buf.query_num + j, format.needs_query_seq());
 					view_query(r, *buffer, format);
 				}
+				format.finish_buffer(*buffer);
 				queue.push(n);
 			}
 		} catch(std::exception &e) {
@@ -138,15 +164,21 @@ void view()
 	Binary_buffer buf;
 	size_t query_num;
 	daa.read_query_buffer(buf, query_num);
-	DAA_query_record r(daa, buf, query_num);
+	DAA_query_record r(daa, buf, query_num, format.needs_query_seq());
 	Text_buffer out;
 	view_query(r, out, format);
 	
-	format.print_header(*writer.f_, daa.mode(), daa.score_matrix(), daa.gap_open_penalty(), daa.gap_extension_penalty(), daa.evalue(), r.query_name.c_str(), (unsigned)r.query_len());
+	format.finish_buffer(out);
+
+	if (config.output_format == "bam")
+		Bam_format::write_header(*writer.f_, daa);
+	else
+		format.print_header(*writer.f_, daa.mode(), daa.score_matrix(), daa.gap_open_penalty(), daa.gap_extension_penalty(), daa.evalue(), r.query_name.c_str(), (unsigned)r.query_len());
 	writer(out);
 
 	View_context context(daa, writer, format);
 	launch_thread_pool(context, config.threads_);
+	context.queue.finish();
 	format.print_footer(*writer.f_);
 }
 
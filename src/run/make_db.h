@@ -23,11 +23,157 @@ Author: Benjamin Buchfink
 
 #include <limits>
 #include <iostream>
+#include <map>
+#include <fstream>
 #include "../basic/config.h"
 #include "../data/reference.h"
 #include "../basic/statistics.h"
 #include "../data/load_seqs.h"
 #include "../util/seq_file_format.h"
+#include "../util/hash_function.h"
+
+/* Replaces identical sequences of the loaded block by a single entry whose
+title joins the titles of the copies with \1, as in nr-style databases.
+Returns the number of removed copies. */
+size_t collapse_duplicates()
+{
+	vector<unsigned> rep;
+	const size_t dups = ref_seqs::get().duplicates(1, rep);
+	if(dups == 0)
+		return 0;
+	std::map<unsigned,string> members;
+	for(unsigned i=0;i<rep.size();++i)
+		if(rep[i] != i)
+			(members[rep[i]] += '\1') += ref_ids::get()[i].c_str();
+
+	Sequence_set *seqs = new Sequence_set;
+	String_set<0> *ids = new String_set<0>;
+	vector<Letter> v;
+	for(unsigned i=0;i<rep.size();++i) {
+		if(rep[i] != i)
+			continue;
+		const sequence seq = ref_seqs::get()[i];
+		v.assign(seq.data(), seq.data() + seq.length());
+		seqs->push_back(v);
+		const sequence id = ref_ids::get()[i];
+		v.assign(id.data(), id.data() + id.length());
+		std::map<unsigned,string>::const_iterator j = members.find(i);
+		if(j != members.end())
+			v.insert(v.end(), j->second.begin(), j->second.end());
+		ids->push_back(v);
+	}
+	seqs->finish_reserve();
+	ids->finish_reserve();
+	delete ref_seqs::data_;
+	delete ref_ids::data_;
+	ref_seqs::data_ = seqs;
+	ref_ids::data_ = ids;
+	return dups;
+}
+
+/* Returns the first word of a sequence title. */
+inline string title_word(const char *title)
+{ return string(title, find_first_of(title, Const::id_delimiters)); }
+
+/* Reads the member -> representative id mapping from a tab-separated file
+of representative and member ids. */
+void load_cluster_map(const string &file_name, std::map<string,string> &rep)
+{
+	std::ifstream f (file_name.c_str());
+	if(!f.good())
+		throw File_open_exception(file_name);
+	string line;
+	while(std::getline(f, line)) {
+		const size_t tab = line.find('\t');
+		if(tab == string::npos)
+			continue;
+		const string r (line.substr(0, tab)),
+			m (title_word(line.c_str() + tab + 1));
+		if(r != m)
+			rep[m] = r;
+	}
+}
+
+/* Reorders the loaded block so that the representatives and unclustered
+sequences come first, followed by the members of each representative.
+A member stays indexed if its representative is not in the block or is a
+member itself. */
+Ref_clusters* cluster_block(const std::map<string,string> &rep_map)
+{
+	const unsigned n = (unsigned)ref_seqs::get().get_length();
+	std::map<string,unsigned> index;
+	for(unsigned i=0;i<n;++i)
+		index[title_word(ref_ids::get()[i].c_str())] = i;
+
+	const unsigned none = std::numeric_limits<unsigned>::max();
+	vector<unsigned> rep (n, none);
+	for(unsigned i=0;i<n;++i) {
+		std::map<string,string>::const_iterator r = rep_map.find(title_word(ref_ids::get()[i].c_str()));
+		if(r == rep_map.end())
+			continue;
+		std::map<string,unsigned>::const_iterator j = index.find(r->second);
+		if(j != index.end())
+			rep[i] = j->second;
+	}
+
+	vector<unsigned> order, rep_rank (n, none);
+	for(unsigned i=0;i<n;++i)
+		if(rep[i] == none || rep[rep[i]] != none) {
+			rep[i] = none;
+			rep_rank[i] = (unsigned)order.size();
+			order.push_back(i);
+		}
+	const unsigned n_reps = (unsigned)order.size();
+	vector<vector<unsigned> > members (n_reps);
+	for(unsigned i=0;i<n;++i)
+		if(rep[i] != none)
+			members[rep_rank[rep[i]]].push_back(i);
+
+	Ref_clusters *clusters = new Ref_clusters;
+	clusters->begin_.push_back(n_reps);
+	for(unsigned i=0;i<n_reps;++i) {
+		order.insert(order.end(), members[i].begin(), members[i].end());
+		clusters->begin_.push_back((uint32_t)order.size());
+	}
+
+	Sequence_set *seqs = new Sequence_set;
+	String_set<0> *ids = new String_set<0>;
+	vector<Letter> v;
+	for(vector<unsigned>::const_iterator i=order.begin();i!=order.end();++i) {
+		const sequence seq = ref_seqs::get()[*i];
+		v.assign(seq.data(), seq.data() + seq.length());
+		seqs->push_back(v);
+		const sequence id = ref_ids::get()[*i];
+		v.assign(id.data(), id.data() + id.length());
+		ids->push_back(v);
+	}
+	seqs->finish_reserve();
+	ids->finish_reserve();
+	seqs->set_indexed(n_reps);
+	delete ref_seqs::data_;
+	delete ref_ids::data_;
+	ref_seqs::data_ = seqs;
+	ref_ids::data_ = ids;
+	return clusters;
+}
+
+/* Folds the sequences and titles of the current block into a running hash
+of the database content. */
+void digest_block(uint64_t &h)
+{
+	const uint64_t prime = 0x100000001b3llu;
+	const Sequence_set &seqs = *ref_seqs::data_;
+	const String_set<0> &ids = ref_ids::get();
+	for(size_t i=0;i<seqs.get_length();++i) {
+		const sequence s = seqs[i];
+		for(size_t j=0;j<s.length();++j)
+			h = (h ^ (uint8_t)s[j]) * prime;
+		h = (h ^ 0xff) * prime;
+		for(const char *c = ids[i].c_str(); *c != 0; ++c)
+			h = (h ^ (uint8_t)*c) * prime;
+		h *= prime;
+	}
+}
 
 void make_db()
 {
@@ -48,9 +194,19 @@ void make_db()
 	ref_header.sequence_type = sequence_type(_val ());
 #endif
 	size_t chunk = 0;
+	uint64_t digest = 0xcbf29ce484222325llu;
 	Output_stream main(config.database);
 	main.typed_write(&ref_header, 1);
 
+	std::map<string,string> cluster_map;
+	if(!config.clusters.empty()) {
+		timer.go("Loading cluster mapping");
+		load_cluster_map(config.clusters, cluster_map);
+		ref_header.clustered = true;
+		ref_header.build = Const::cluster_build;
+		timer.finish();
+	}
+
 	for(;;++chunk) {
 		timer.go("Loading sequences");
 		Sequence_set* ss;
@@ -59,6 +215,16 @@ void make_db()
 			break;
 		ref_header.letters += ref_seqs::data_->letters();
 		ref_header.sequences += n_seq;
+		if(config.collapse_duplicates) {
+			timer.go("Collapsing duplicate sequences");
+			verbose_stream << "Duplicate sequences = " << collapse_duplicates() << endl;
+		}
+		auto_ptr<Ref_clusters> clusters;
+		if(ref_header.clustered) {
+			timer.go("Clustering sequences");
+			clusters = auto_ptr<Ref_clusters> (cluster_block(cluster_map));
+			verbose_stream << "Cluster representatives = " << clusters->representatives() << endl;
+		}
 		const bool long_addressing = ref_seqs::data_->raw_len() > (size_t)std::numeric_limits<uint32_t>::max();
 		ref_header.long_addressing = ref_header.long_addressing == true ? true : long_addressing;
 		timer.finish();
@@ -68,9 +234,12 @@ void make_db()
 		seed_histogram *hst = new seed_histogram (*ref_seqs::data_);
 
 		timer.go("Saving to disk");
+		digest_block(digest);
 		ref_seqs::data_->save(main);
 		ref_ids::get().save(main);
 		hst->save(main);
+		if(clusters.get())
+			clusters->save(main);
 
 		timer.go("Deallocating sequences");
 		delete ref_seqs::data_;
@@ -81,6 +250,7 @@ void make_db()
 
 	timer.finish();
 	ref_header.n_blocks = (unsigned)chunk;
+	ref_header.digest = std::max((uint32_t)murmur_hash()(digest), (uint32_t)1);
 	main.seekp(0);
 	main.typed_write(&ref_header, 1);
 	main.close();
@@ -26,10 +26,14 @@ LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR P
 #include "../basic/statistics.h"
 #include "../basic/shape_config.h"
 #include "../output/join_blocks.h"
+#include "../output/text_output.h"
 #include "../align/align_queries.h"
 #include "../search/align_range.h"
 #include "../util/seq_file_format.h"
 #include "../data/load_seqs.h"
+#include "../data/query_index.h"
+#include "../data/query_dedup.h"
+#include "../data/result_cache.h"
 #include "../search/setup.h"
 
 using std::endl;
@@ -37,10 +41,11 @@ using std::cout;
 
 struct Search_context
 {
-	Search_context(unsigned sid, const sorted_list &ref_idx, const sorted_list &query_idx):
+	Search_context(unsigned sid, const sorted_list &ref_idx, const sorted_list &query_idx, const Index_fps *query_fps):
 		sid (sid),
 		ref_idx (ref_idx),
-		query_idx (query_idx)
+		query_idx (query_idx),
+		query_fps (query_fps)
 	{ }
 	void operator()(unsigned thread_id, unsigned seedp) const
 	{
@@ -50,18 +55,38 @@ struct Search_context
 				sid,
 				ref_idx.get_partition_cbegin(seedp),
 				query_idx.get_partition_cbegin(seedp),
-				thread_id);
+				thread_id,
+				query_fps);
 		statistics += stat;
 	}
 	const unsigned sid;
 	const sorted_list &ref_idx;
 	const sorted_list &query_idx;
+	const Index_fps *query_fps;
 };
 
+const sorted_list* get_query_index(unsigned sid,
+		unsigned chunk,
+		const seedp_range &range,
+		char *query_buffer,
+		Query_index_cache *query_idx_cache,
+		auto_ptr<sorted_list> &query_idx)
+{
+	if(query_idx_cache)
+		return &query_idx_cache->get(sid, chunk);
+	query_idx = auto_ptr<sorted_list> (new sorted_list (query_buffer,
+		*query_seqs::data_,
+		shapes.get_shape(sid),
+		query_hst->get(config.index_mode, sid),
+		range));
+	return query_idx.get();
+}
+
 void process_shape(unsigned sid,
 		Timer &timer_mapping,
 		unsigned query_chunk,
 		char *query_buffer,
+		Query_index_cache *query_idx_cache,
 		char *ref_buffer)
 {
 	using std::vector;
@@ -73,126 +98,484 @@ void process_shape(unsigned sid,
 		const seedp_range range (p.getMin(chunk), p.getMax(chunk));
 		current_range = range;
 
-		task_timer timer ("Building reference index", true);
-		sorted_list ref_idx (ref_buffer,
+		task_timer timer (config.query_filter ? "Building query index" : "Building reference index", true);
+		auto_ptr<sorted_list> ref_idx, query_own;
+		const sorted_list *query_idx;
+		char *filtered_buffer = 0;
+		if(config.query_filter) {
+			timer_mapping.resume();
+			query_idx = get_query_index(sid, chunk, range, query_buffer, query_idx_cache, query_own);
+
+			timer.go("Building query seed filter");
+			const Seed_filter filter (*query_idx);
+
+			timer.go("Counting reference seeds");
+			const auto_ptr<sorted_list::Filtered_histogram> hst (new sorted_list::Filtered_histogram (*ref_seqs::data_, shapes.get_shape(sid), range, filter));
+
+			timer.go("Building reference index");
+			filtered_buffer = sorted_list::alloc_buffer(hst->data, range);
+			ref_idx = auto_ptr<sorted_list> (new sorted_list (filtered_buffer,
+				*ref_seqs::data_,
+				shapes.get_shape(sid),
+				hst->data,
+				range,
+				&filter));
+			ref_seqs::get_nc().build_masking(sid, range, *ref_idx);
+		} else {
+			ref_idx = auto_ptr<sorted_list> (new sorted_list (ref_buffer,
 				*ref_seqs::data_,
 				shapes.get_shape(sid),
 				ref_hst.get(config.index_mode, sid),
-				range);
-		ref_seqs::get_nc().build_masking(sid, range, ref_idx);
+				range));
+			ref_seqs::get_nc().build_masking(sid, range, *ref_idx);
 
-		timer.go("Building query index");
-		timer_mapping.resume();
-		sorted_list query_idx (query_buffer,
-				*query_seqs::data_,
-				shapes.get_shape(sid),
-				query_hst->get(config.index_mode, sid),
-				range);
+			timer.go("Building query index");
+			timer_mapping.resume();
+			query_idx = get_query_index(sid, chunk, range, query_buffer, query_idx_cache, query_own);
+		}
 		timer.finish();
 
 		timer.go("Searching alignments");
-		Search_context context (sid, ref_idx, query_idx);
+		Search_context context (sid, *ref_idx, *query_idx, query_idx_cache ? &query_idx_cache->get_fps(sid, chunk) : 0);
 #ifdef SIMPLE_SEARCH
 		launch_scheduled_thread_pool(context, Const::seedp, config.threads_);
 #else
 		launch_scheduled_thread_pool(context, Const::seedp, 1);
 #endif
+		ref_idx.reset();
+		delete[] filtered_buffer;
 	}
 	timer_mapping.stop();
 }
 
-void run_ref_chunk(Database_file &db_file,
-		Timer &timer_mapping,
-		Timer &total_timer,
+/* Reads the reference blocks from the database file. The next block can be
+read by a background thread while the alignments of the current block are
+computed. */
+struct Ref_loader
+{
+
+	Ref_loader(Database_file &db_file):
+		db_file_ (db_file),
+		seqs_ (0),
+		ids_ (0),
+		clusters_ (0),
+		thread_ (0)
+	{ }
+
+	~Ref_loader()
+	{
+		if(thread_) {
+			thread_->join();
+			delete thread_;
+		}
+		delete seqs_;
+		delete ids_;
+		delete clusters_;
+	}
+
+	void rewind()
+	{ db_file_.rewind(); }
+
+	void load()
+	{
+		task_timer timer ("Loading reference sequences", true);
+		if(thread_) {
+			thread_->join();
+			delete thread_;
+			thread_ = 0;
+			if(!error_.empty())
+				throw std::runtime_error(error_);
+			ref_seqs::data_ = seqs_;
+			ref_ids::data_ = ids_;
+			ref_clusters::data_ = clusters_;
+			ref_hst = *hst_;
+			seqs_ = 0;
+			ids_ = 0;
+			clusters_ = 0;
+		} else {
+			ref_seqs::data_ = new Masked_sequence_set (db_file_);
+			ref_ids::data_ = new String_set<0> (db_file_);
+			ref_hst.load(db_file_);
+			ref_clusters::data_ = load_clusters(db_file_, *ref_seqs::data_);
+		}
+		ref_map.init((unsigned)ref_seqs::get().get_length());
+	}
+
+	/* Starts reading the block following the current one. Opt-in, since the
+	next block is held in memory together with the current one. */
+	void prefetch()
+	{
+		if(!config.prefetch || thread_ != 0 || current_ref_block + 1 >= ref_header.n_blocks)
+			return;
+		if(hst_.get() == 0)
+			hst_ = auto_ptr<seed_histogram> (new seed_histogram ());
+		thread_ = new tthread::thread(prefetch_worker, (void*)this);
+	}
+
+private:
+
+	/* Reads the cluster table of a clustered database and restricts the
+	seed index to the representatives. */
+	static Ref_clusters* load_clusters(Database_file &db_file, Sequence_set &seqs)
+	{
+		if(!ref_header.clustered)
+			return 0;
+		Ref_clusters *clusters = new Ref_clusters (db_file);
+		seqs.set_indexed(clusters->representatives());
+		return clusters;
+	}
+
+	static void prefetch_worker(void *p)
+	{
+		Ref_loader &l = *(Ref_loader*)p;
+		try {
+			l.seqs_ = new Masked_sequence_set (l.db_file_);
+			l.ids_ = new String_set<0> (l.db_file_);
+			l.hst_->load(l.db_file_);
+			l.clusters_ = load_clusters(l.db_file_, *l.seqs_);
+		} catch(std::exception &e) {
+			l.error_ = e.what();
+		}
+	}
+
+	Database_file &db_file_;
+	Masked_sequence_set *seqs_;
+	String_set<0> *ids_;
+	Ref_clusters *clusters_;
+	auto_ptr<seed_histogram> hst_;
+	string error_;
+	tthread::thread *thread_;
+
+};
+
+void free_ref_block()
+{
+	task_timer timer ("Deallocating reference", true);
+	delete ref_seqs::data_;
+	delete ref_ids::data_;
+	delete ref_clusters::data_;
+	ref_clusters::data_ = 0;
+}
+
+void search_ref_block(Timer &timer_mapping,
 		unsigned query_chunk,
 		pair<size_t,size_t> query_len_bounds,
 		char *query_buffer,
-		DAA_output &master_out,
-		vector<Temp_file> &tmp_file)
+		Query_index_cache *query_idx_cache,
+		Output_stream *out,
+		vector<Block_chunk> *chunks,
+		Ref_loader *next_block)
 {
-	task_timer timer ("Loading reference sequences", true);
-	ref_seqs::data_ = new Masked_sequence_set (db_file);
-	ref_ids::data_ = new String_set<0> (db_file);
-	ref_hst.load(db_file);
 	setup_search_params(query_len_bounds, ref_seqs::data_->letters());
-	ref_map.init((unsigned)ref_seqs::get().get_length());
 
-	timer.go("Allocating buffers");
-	char *ref_buffer = sorted_list::alloc_buffer(ref_hst);
+	task_timer timer ("Allocating buffers", true);
+	char *ref_buffer = config.query_filter ? 0 : sorted_list::alloc_buffer(ref_hst);
 
 	timer.go("Initializing temporary storage");
 	timer_mapping.resume();
 	Trace_pt_buffer::instance = new Trace_pt_buffer (query_seqs::data_->get_length()/align_mode.query_contexts,
 			config.tmpdir,
 			config.mem_buffered());
+	if(config.diagonal_cache)
+		Diagonal_cache::instance = new Diagonal_cache;
+	if(config.shape_early_stop)
+		Query_saturation::instance = new Query_saturation(query_seqs::data_->get_length()/align_mode.query_contexts);
 	timer.finish();
 	timer_mapping.stop();
 
-	for(unsigned i=0;i<shapes.count();++i)
-		process_shape(i, timer_mapping, query_chunk, query_buffer, ref_buffer);
+	for(unsigned i=0;i<shapes.count();++i) {
+		process_shape(i, timer_mapping, query_chunk, query_buffer, query_idx_cache, ref_buffer);
+		if(Query_saturation::instance)
+			Query_saturation::instance->update();
+	}
 
-	/*timer.go("Closing temporary storage");
-	Trace_pt_buffer::instance->close();*/
+	timer.go("Closing temporary storage");
+	timer_mapping.resume();
+	Trace_pt_buffer::instance->close();
+	delete Diagonal_cache::instance;
+	Diagonal_cache::instance = 0;
+	delete Query_saturation::instance;
+	Query_saturation::instance = 0;
+	timer_mapping.stop();
 
 	timer.go("Deallocating buffers");
 	delete[] ref_buffer;
 
+	if(next_block)
+		next_block->prefetch();
+
+	timer.go("Computing alignments");
 	timer_mapping.resume();
+	align_queries(*Trace_pt_buffer::instance, out, chunks);
+	delete Trace_pt_buffer::instance;
+	timer_mapping.stop();
+}
+
+/* Whether the output of the reference blocks is written to temporary files
+that are joined at the end. */
+bool join_output()
+{
+	return ref_header.n_blocks > 1 || Query_dedup::instance != 0 || Result_cache::instance != 0;
+}
+
+void run_ref_chunk(Ref_loader &ref_loader,
+		Timer &timer_mapping,
+		Timer &total_timer,
+		unsigned query_chunk,
+		pair<size_t,size_t> query_len_bounds,
+		char *query_buffer,
+		Query_index_cache *query_idx_cache,
+		Master_output &master_out,
+		vector<Temp_file> &tmp_file,
+		vector<vector<Block_chunk> > &tmp_chunks)
+{
+	ref_loader.load();
+
 	Output_stream* out;
-	if(ref_header.n_blocks > 1) {
-		timer.go ("Opening temporary output file");
+	if(join_output()) {
+		task_timer timer ("Opening temporary output file", true);
 		tmp_file.push_back(Temp_file ());
+		tmp_chunks.push_back(vector<Block_chunk> ());
 		out = new Output_stream (tmp_file.back());
 	} else
 		out = &master_out.stream();
 
-	timer.go("Computing alignments");
-	align_queries(*Trace_pt_buffer::instance, out);
-	delete Trace_pt_buffer::instance;
+	search_ref_block(timer_mapping, query_chunk, query_len_bounds, query_buffer, query_idx_cache, out, join_output() ? &tmp_chunks.back() : 0, &ref_loader);
 
-	if(ref_header.n_blocks > 1) {
+	if(join_output())
 		delete out;
-	}
-	timer_mapping.stop();
 
-	timer.go("Deallocating reference");
-	delete ref_seqs::data_;
-	delete ref_ids::data_;
-	timer.finish();
+	free_ref_block();
 }
 
-void run_query_chunk(Database_file &db_file,
+void run_query_chunk(Ref_loader &ref_loader,
 		Timer &timer_mapping,
 		Timer &total_timer,
 		unsigned query_chunk,
 		pair<size_t,size_t> query_len_bounds,
-		DAA_output &master_out)
+		Master_output &master_out)
 {
 	task_timer timer ("Allocating buffers", true);
-	char *query_buffer = sorted_list::alloc_buffer(*query_hst);
+	auto_ptr<Query_index_cache> query_idx_cache;
+	char *query_buffer = 0;
+	if(ref_header.n_blocks > 1 && Query_index_cache::fits(*query_hst))
+		query_idx_cache = auto_ptr<Query_index_cache> (new Query_index_cache (*query_hst));
+	else
+		query_buffer = sorted_list::alloc_buffer(*query_hst);
 	vector<Temp_file> tmp_file;
+	vector<vector<Block_chunk> > tmp_chunks;
 	timer.finish();
 
-	db_file.rewind();
-	for(current_ref_block=0;current_ref_block<ref_header.n_blocks;++current_ref_block)
-		run_ref_chunk(db_file, timer_mapping, total_timer, query_chunk, query_len_bounds, query_buffer, master_out, tmp_file);
+	ref_loader.rewind();
+	if(query_ids::get().get_length() > 0)
+		for(current_ref_block=0;current_ref_block<ref_header.n_blocks;++current_ref_block)
+			run_ref_chunk(ref_loader, timer_mapping, total_timer, query_chunk, query_len_bounds, query_buffer, query_idx_cache.get(), master_out, tmp_file, tmp_chunks);
 
 	timer.go("Deallocating buffers");
 	timer_mapping.resume();
 	delete[] query_buffer;
+	query_idx_cache.reset();
 
-	if(ref_header.n_blocks > 1) {
+	if(join_output()) {
 		timer.go("Joining output blocks");
-		join_blocks(ref_header.n_blocks, master_out, tmp_file);
+		if(Query_dedup::instance)
+			Query_dedup::instance->swap_sets();
+		if(Cached_queries::instance)
+			Cached_queries::instance->swap_sets();
+		join_blocks((unsigned)tmp_file.size(), master_out, tmp_file, tmp_chunks);
 	}
 
 	timer.go("Deallocating queries");
 	delete query_seqs::data_;
 	delete query_ids::data_;
 	delete query_source_seqs::data_;
+	delete Query_dedup::instance;
+	Query_dedup::instance = 0;
+	delete Cached_queries::instance;
+	Cached_queries::instance = 0;
 	timer_mapping.stop();
 }
 
+bool load_query_chunk(Compressed_istream &query_file,
+		const Sequence_file_format &format,
+		Timer &timer_mapping,
+		pair<size_t,size_t> &query_len_bounds)
+{
+	static size_t loaded_queries = 0;
+	task_timer timer ("Loading query sequences", true);
+	timer_mapping.resume();
+	size_t n_query_seqs;
+	n_query_seqs = load_seqs(query_file, format, &query_seqs::data_, query_ids::data_, query_source_seqs::data_, (size_t)(config.chunk_size * 1e9));
+	if(n_query_seqs == 0) {
+		timer_mapping.stop();
+		return false;
+	}
+	current_query_offset = loaded_queries;
+	loaded_queries += query_ids::get().get_length();
+	timer.finish();
+	query_seqs::data_->print_stats();
+
+	if(align_mode.sequence_type == amino_acid && config.seg == "yes") {
+		timer.go("Running complexity filter");
+		Complexity_filter::get().run(*query_seqs::data_);
+	}
+
+	if(Result_cache::instance) {
+		timer.go("Looking up cached results");
+		Cached_queries::instance = Cached_queries::build(*Result_cache::instance);
+		if(Cached_queries::instance)
+			verbose_stream << "Cached queries = " << Cached_queries::instance->hits().size() << endl;
+	}
+
+	if(config.query_dedup) {
+		timer.go("Removing duplicate queries");
+		Query_dedup::instance = Query_dedup::build();
+		if(Query_dedup::instance)
+			verbose_stream << "Duplicate queries = " << Query_dedup::instance->duplicates().size() << endl;
+	}
+
+	timer.go("Building query histograms");
+	query_hst = auto_ptr<seed_histogram> (new seed_histogram (*query_seqs::data_));
+	query_len_bounds = query_seqs::data_->len_bounds(shapes.get_shape(0).length_);
+	timer_mapping.stop();
+	timer.finish();
+	return true;
+}
+
+/* Query chunk kept resident in reference-major order, together with its
+per-block temporary output. */
+struct Query_chunk
+{
+	/* Caches the query indexes of the chunk if they fit into the remaining
+	cache budget, which is shared by all resident chunks. */
+	Query_chunk(pair<size_t,size_t> len_bounds, size_t &cache_budget):
+		seqs (query_seqs::data_),
+		source_seqs (query_source_seqs::data_),
+		ids (query_ids::data_),
+		hst (query_hst.release()),
+		dedup (Query_dedup::instance),
+		cached (Cached_queries::instance),
+		query_offset (current_query_offset),
+		len_bounds (len_bounds)
+	{
+		if(ref_header.n_blocks > 1 && Query_index_cache::fits(*hst, cache_budget)) {
+			idx_cache = auto_ptr<Query_index_cache> (new Query_index_cache (*hst));
+			cache_budget -= Query_index_cache::mem_size(*hst);
+		}
+	}
+	~Query_chunk()
+	{
+		idx_cache.reset();
+		if(query_hst.get() == hst)
+			query_hst.release();
+		delete hst;
+		delete seqs;
+		delete source_seqs;
+		delete ids;
+		if(Query_dedup::instance == dedup)
+			Query_dedup::instance = 0;
+		delete dedup;
+		if(Cached_queries::instance == cached)
+			Cached_queries::instance = 0;
+		delete cached;
+	}
+	void activate()
+	{
+		query_seqs::data_ = seqs;
+		query_source_seqs::data_ = source_seqs;
+		query_ids::data_ = ids;
+		Query_dedup::instance = dedup;
+		Cached_queries::instance = cached;
+		current_query_offset = query_offset;
+		if(query_hst.get() != hst) {
+			query_hst.release();
+			query_hst = auto_ptr<seed_histogram> (hst);
+		}
+	}
+	/* Puts the full query sets back for the output of a chunk with duplicate
+	or cached queries. */
+	void restore_queries()
+	{
+		if(dedup)
+			dedup->swap_sets();
+		if(cached)
+			cached->swap_sets();
+		seqs = query_seqs::data_;
+		source_seqs = query_source_seqs::data_;
+		ids = query_ids::data_;
+	}
+	Sequence_set *seqs, *source_seqs;
+	String_set<0> *ids;
+	seed_histogram *hst;
+	Query_dedup *dedup;
+	Cached_queries *cached;
+	const size_t query_offset;
+	const pair<size_t,size_t> len_bounds;
+	auto_ptr<Query_index_cache> idx_cache;
+	vector<Temp_file> tmp_file;
+	vector<vector<Block_chunk> > tmp_chunks;
+};
+
+/* Loads all query chunks and reads each reference block only once, searching
+all query chunks against it. The per-chunk temporary outputs are joined in
+query chunk order at the end. */
+void run_ref_major(Compressed_istream &query_file,
+		const Sequence_file_format &format,
+		Ref_loader &ref_loader,
+		Timer &timer_mapping,
+		Master_output &master_out)
+{
+	vector<Query_chunk*> chunks;
+	pair<size_t,size_t> query_len_bounds;
+	size_t cache_budget = Query_index_cache::budget();
+	while(load_query_chunk(query_file, format, timer_mapping, query_len_bounds))
+		chunks.push_back(new Query_chunk (query_len_bounds, cache_budget));
+
+	ref_loader.rewind();
+	for(current_ref_block=0;current_ref_block<ref_header.n_blocks;++current_ref_block) {
+		ref_loader.load();
+		for(current_query_chunk=0;current_query_chunk<chunks.size();++current_query_chunk) {
+			Query_chunk &chunk = *chunks[current_query_chunk];
+			if(chunk.ids->get_length() == 0)
+				continue;
+			chunk.activate();
+			if(current_query_chunk > 0)
+				ref_seqs::get_nc().clear_masking();
+
+			task_timer timer ("Opening temporary output file", true);
+			chunk.tmp_file.push_back(Temp_file ());
+			chunk.tmp_chunks.push_back(vector<Block_chunk> ());
+			Output_stream out (chunk.tmp_file.back());
+			char *query_buffer = chunk.idx_cache.get() ? 0 : sorted_list::alloc_buffer(*chunk.hst);
+			timer.finish();
+
+			search_ref_block(timer_mapping, current_query_chunk, chunk.len_bounds, query_buffer, chunk.idx_cache.get(), &out, join_output() ? &chunk.tmp_chunks.back() : 0,
+				current_query_chunk + 1 == chunks.size() ? &ref_loader : 0);
+			delete[] query_buffer;
+		}
+		free_ref_block();
+	}
+
+	for(current_query_chunk=0;current_query_chunk<chunks.size();++current_query_chunk) {
+		Query_chunk &chunk = *chunks[current_query_chunk];
+		chunk.activate();
+		task_timer timer ("Joining output blocks", true);
+		timer_mapping.resume();
+		if(chunk.dedup || chunk.cached)
+			chunk.restore_queries();
+		if(join_output())
+			join_blocks((unsigned)chunk.tmp_file.size(), master_out, chunk.tmp_file, chunk.tmp_chunks);
+		else
+			copy_block(chunk.tmp_file.front(), master_out);
+		timer.go("Deallocating queries");
+		delete &chunk;
+		timer_mapping.stop();
+	}
+	query_seqs::data_ = 0;
+	query_source_seqs::data_ = 0;
+	query_ids::data_ = 0;
+}
+
 void master_thread(Database_file &db_file, Timer &timer_mapping, Timer &total_timer)
 {
 	task_timer timer ("Opening the input file", true);
@@ -202,40 +585,37 @@ void master_thread(Database_file &db_file, Timer &timer_mapping, Timer &total_ti
 	current_query_chunk=0;
 
 	timer.go("Opening the output file");
-	DAA_output master_out;
+	auto_ptr<Master_output> master_out (direct_output() ? (Master_output*)new Text_output : new DAA_output);
 	timer_mapping.stop();
 	timer.finish();
 
-	for(;;++current_query_chunk) {
-		task_timer timer ("Loading query sequences", true);
-		timer_mapping.resume();
-		size_t n_query_seqs;
-		n_query_seqs = load_seqs(query_file, *format_n, &query_seqs::data_, query_ids::data_, query_source_seqs::data_, (size_t)(config.chunk_size * 1e9));
-		if(n_query_seqs == 0)
-			break;
+	if(!config.result_cache.empty()) {
+		timer.go("Loading the result cache");
+		Result_cache::instance = new Result_cache (config.result_cache);
+		verbose_stream << "Result cache entries = " << Result_cache::instance->size() << endl;
 		timer.finish();
-		query_seqs::data_->print_stats();
-
-		if(align_mode.sequence_type == amino_acid && config.seg == "yes") {
-			timer.go("Running complexity filter");
-			Complexity_filter::get().run(*query_seqs::data_);
-		}
-
-		timer.go("Building query histograms");
-		query_hst = auto_ptr<seed_histogram> (new seed_histogram (*query_seqs::data_));
-		const pair<size_t,size_t> query_len_bounds = query_seqs::data_->len_bounds(shapes.get_shape(0).length_);
-		timer_mapping.stop();
-		timer.finish();
-		//const bool long_addressing_query = query_seqs::data_->raw_len() > (size_t)std::numeric_limits<uint32_t>::max();
-
-		run_query_chunk(db_file, timer_mapping, total_timer, current_query_chunk, query_len_bounds, master_out);
 	}
 
+	pair<size_t,size_t> query_len_bounds;
+	Ref_loader ref_loader (db_file);
+	if(config.ref_major)
+		run_ref_major(query_file, *format_n, ref_loader, timer_mapping, *master_out);
+	else
+		for(;load_query_chunk(query_file, *format_n, timer_mapping, query_len_bounds);++current_query_chunk)
+			run_query_chunk(ref_loader, timer_mapping, total_timer, current_query_chunk, query_len_bounds, *master_out);
+
 	timer.go("Closing the output file");
 	timer_mapping.resume();
-	master_out.finish();
+	master_out->finish();
 	timer_mapping.stop();
 
+	if(Result_cache::instance) {
+		timer.go("Saving the result cache");
+		Result_cache::instance->save();
+		delete Result_cache::instance;
+		Result_cache::instance = 0;
+	}
+
 	timer.go("Closing the database file");
 	db_file.close();
 
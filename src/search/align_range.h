@@ -22,29 +22,33 @@ Author: Benjamin Buchfink
 #define ALIGN_RANGE_H_
 
 #include "filter_hit.h"
+#include "index_fps.h"
 #include "../basic/statistics.h"
 
 inline void align_range(Loc q_pos,
 				 const sorted_list::const_iterator &s,
 				 Statistics &stats,
 				 Trace_pt_buffer::Iterator &out,
-				 unsigned sid)
+				 unsigned sid,
+				 Diagonal_cache::Table *cache)
 {
+	if(Query_saturation::instance && Query_saturation::instance->saturated(q_pos))
+		return;
 	unsigned i = 0, n=0;
 
 	const Letter* query = query_seqs::data_->data(q_pos);
-	hit_filter hf (stats, q_pos, out);
+	hit_filter hf (stats, q_pos, out, cache);
 
 	if(s.n <= config.hit_cap) {
 		stats.inc(Statistics::SEED_HITS, s.n);
 		while(i < s.n) {
-			align(q_pos, query, s[i], stats, sid, hf);
+			align(q_pos, query, s[i], stats, sid, hf, cache);
 			++i;
 		}
 	} else {
 		while(i < s.n && s[i] != 0) {
 			assert(position_filter(s[i], filter_treshold((unsigned)s.n), s.key()));
-			align(q_pos, query, s[i], stats, sid, hf);
+			align(q_pos, query, s[i], stats, sid, hf, cache);
 			stats.inc(Statistics::SEED_HITS);
 			++i;
 			++n;
@@ -62,14 +66,15 @@ inline void align_range(const sorted_list::const_iterator &q,
 				 const sorted_list::const_iterator &s,
 				 Statistics &stats,
 				 Trace_pt_buffer::Iterator &out,
-				 const unsigned sid)
+				 const unsigned sid,
+				 Diagonal_cache::Table *cache)
 {
 #ifdef EXTRA
 	//if(q.n > 4096)
 		//printf("%lu %lu\n",q.n,s.n);
 #endif
 	for(unsigned i=0;i<q.n; ++i)
-		align_range(Loc(q[i]), s, stats, out, sid);
+		align_range(Loc(q[i]), s, stats, out, sid, cache);
 }
 
 struct Stage1_hit
@@ -96,45 +101,61 @@ void search_seed(const sorted_list::const_iterator &q,
 	const sorted_list::const_iterator &s,
 	Statistics &stats,
 	Trace_pt_buffer::Iterator &out,
-	const unsigned sid);
+	const unsigned sid,
+	const Finger_print *q_fps,
+	Diagonal_cache::Table *cache);
 
 void stage2_search(const sorted_list::const_iterator &q,
 	const sorted_list::const_iterator &s,
 	const vector<Stage1_hit> &hits,
 	Statistics &stats,
 	Trace_pt_buffer::Iterator &out,
-	const unsigned sid);
+	const unsigned sid,
+	Diagonal_cache::Table *cache);
+
+/* Size ratio of the partition lists above which the larger list is advanced
+by exponential search instead of key by key. */
+const size_t gallop_ratio = 16;
 
 inline void align_partition(unsigned hp,
 		Statistics &stats,
 		unsigned sid,
 		sorted_list::const_iterator i,
 		sorted_list::const_iterator j,
-		unsigned thread_id)
+		unsigned thread_id,
+		const Index_fps *query_fps = 0)
 {
 #ifndef SIMPLE_SEARCH
 	if (hp > 0)
 		return;
 #endif
-	Trace_pt_buffer::Iterator* out = new Trace_pt_buffer::Iterator (*Trace_pt_buffer::instance, thread_id);
+	Trace_pt_buffer::Iterator &out = Trace_pt_buffer::instance->get_iterator(thread_id);
+	Diagonal_cache::Table *cache = Diagonal_cache::instance ? &Diagonal_cache::instance->get(thread_id) : 0;
+	const bool gallop_i = i.size() > gallop_ratio * j.size(),
+		gallop_j = j.size() > gallop_ratio * i.size();
 	while(!i.at_end() && !j.at_end()) {
 		if(i.key() < j.key()) {
-			++i;
+			if(gallop_i)
+				i.seek(j.key());
+			else
+				++i;
 		} else if(j.key() < i.key()) {
-			++j;
+			if(gallop_j)
+				j.seek(i.key());
+			else
+				++j;
 		} else {
 			if (!config.slow_search) {
 				//cout << "n=" << stats.data_[Statistics::SEED_HITS] << endl;
 				/*if (stats.data_[Statistics::SEED_HITS] > 10000000000lu)
 				break;*/
-				search_seed(j, i, stats, *out, sid);
+				search_seed(j, i, stats, out, sid, query_fps ? query_fps->get(hp, j) : 0, cache);
 			} else
-				align_range(j, i, stats, *out, sid);
+				align_range(j, i, stats, out, sid, cache);
 			++i;
 			++j;
 		}
 	}
-	delete out;
 }
 
 #endif /* ALIGN_RANGE_H_ */
@@ -0,0 +1,93 @@
+/****
+Copyright (c) 2016, University of Tuebingen, Benjamin Buchfink
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification, are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this list of conditions and the following disclaimer.
+
+2. Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the following disclaimer in the documentation and/or other materials provided with the distribution.
+
+3. Neither the name of the copyright holder nor the names of its contributors may be used to endorse or promote products derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+****/
+#ifndef DIAGONAL_CACHE_H_
+#define DIAGONAL_CACHE_H_
+
+#include <vector>
+#include <stdint.h>
+#include "../basic/packed_loc.h"
+#include "../basic/config.h"
+#include "../util/simd_hash_table.h"
+#include "../util/hash_function.h"
+
+using std::vector;
+
+/* Ungapped extents of seed hits that produced a trace point. Every search
+thread has its own table, so lookups take no lock. A later seed hit of the
+same thread that lies on the same diagonal inside a cached extent belongs to
+an ungapped segment that has already been reported, so its extension and
+collision check are skipped. Extents are indexed by diagonal and by each
+subject block they overlap. A table is cleared when it reaches its capacity,
+which bounds the memory of the cache. */
+struct Diagonal_cache
+{
+
+	struct Table
+	{
+		bool contains(Loc q, Loc s) const
+		{
+			const int64_t d = (int64_t)s - (int64_t)q;
+			const Extent *e = table_.find(get_key(d, s >> block_bits));
+			return e != 0 && e->diagonal == d && s >= e->begin && s < e->begin + e->len;
+		}
+		void insert(Loc q_begin, Loc s_begin, unsigned len)
+		{
+			if(table_.size() >= max_size)
+				table_.clear();
+			const Extent e = { (int64_t)s_begin - (int64_t)q_begin, s_begin, len };
+			for(Loc b = s_begin >> block_bits; b <= (s_begin + len - 1) >> block_bits; ++b)
+				table_.insert(get_key(e.diagonal, b), e);
+		}
+	private:
+		struct Extent
+		{
+			int64_t diagonal;
+			Loc begin;
+			unsigned len;
+		};
+		enum { block_bits = 8, max_size = 1 << 18 };
+		static uint64_t get_key(int64_t d, Loc block)
+		{ return (uint64_t)d * 0x9E3779B97F4A7C15LLU + block; }
+		Simd_hash_table<uint64_t, Extent, murmur_hash> table_;
+	};
+
+	Diagonal_cache():
+		tables_ (config.threads_)
+	{
+		for(unsigned i=0;i<tables_.size();++i)
+			tables_[i] = new Table;
+	}
+
+	~Diagonal_cache()
+	{
+		for(unsigned i=0;i<tables_.size();++i)
+			delete tables_[i];
+	}
+
+	Table& get(unsigned thread_id)
+	{ return *tables_[thread_id]; }
+
+	static Diagonal_cache *instance;
+
+private:
+
+	vector<Table*> tables_;
+
+};
+
+#endif /* DIAGONAL_CACHE_H_ */
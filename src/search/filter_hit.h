@@ -35,7 +35,8 @@ inline void align(Loc q_pos,
 	  Loc s,
 	  Statistics &stats,
 	  const unsigned sid,
-	  hit_filter &hf)
+	  hit_filter &hf,
+	  const Diagonal_cache::Table *cache)
 {
 	const Letter* subject = ref_seqs::data_->data(s);
 
@@ -44,6 +45,9 @@ inline void align(Loc q_pos,
 
 	stats.inc(Statistics::TENTATIVE_MATCHES1);
 
+	if(cache && cache->contains(q_pos, s))
+		return;
+
 	unsigned delta, len;
 	int score;
 	if((score = xdrop_ungapped(query, subject, shapes.get_shape(sid).length_, delta, len)) < config.min_ungapped_raw_score)
@@ -55,7 +59,7 @@ inline void align(Loc q_pos,
 		return;
 
 	stats.inc(Statistics::TENTATIVE_MATCHES3);
-	hf.push(s, score);
+	hf.push(s, score, delta, len);
 }
 
 #endif
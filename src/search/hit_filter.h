@@ -23,37 +23,63 @@ Author: Benjamin Buchfink
 
 #include <vector>
 #include <limits>
+#include <algorithm>
 #include "trace_pt_buffer.h"
 #include "../dp/smith_waterman.h"
 #include "../basic/sequence.h"
 #include "../data/queries.h"
+#include "query_saturation.h"
+#include "diagonal_cache.h"
 
 using std::vector;
+using std::pair;
 
 struct hit_filter
 {
 
 	hit_filter(Statistics &stats,
 			   Loc q_pos,
-			   Trace_pt_buffer::Iterator &out):
+			   Trace_pt_buffer::Iterator &out,
+			   Diagonal_cache::Table *cache = 0):
 		q_num_ (std::numeric_limits<unsigned>::max()),
 		seed_offset_ (std::numeric_limits<unsigned>::max()),
 		stats_ (stats),
 		q_pos_ (q_pos),
 		out_ (out),
-		subjects_ (subjects_ptr)
-	{ subjects_->clear(); }
+		cache_ (cache),
+		subjects_ (subjects_ptr),
+		extents_ (extents_ptr),
+		strong_ (strong_ptr)
+	{
+		subjects_->clear();
+		extents_->clear();
+		strong_->clear();
+	}
 
-	void push(Loc subject, int score)
+	/* The ungapped extent of the hit starts delta letters before the seed
+	and has length len. It is added to the diagonal cache only if the hit
+	produces a trace point. */
+	void push(Loc subject, int score, unsigned delta, unsigned len)
 	{
-		if(score >= config.min_hit_score)
+		if(score >= config.min_hit_score) {
 			push_hit(subject);
-		else
+			cache_extent(subject, delta, len);
+			if(Query_saturation::instance)
+				strong_->push_back((unsigned)ref_seqs::data_->local_position(subject).first);
+		} else {
 			subjects_->push_back(ref_seqs::data_->fixed_window_infix(subject+Const::seed_anchor));
+			if(cache_)
+				extents_->push_back(pair<unsigned,unsigned> (delta, len));
+		}
 	}
 
 	void finish()
 	{
+		if(!strong_->empty()) {
+			std::sort(strong_->begin(), strong_->end());
+			strong_->erase(std::unique(strong_->begin(), strong_->end()), strong_->end());
+			Query_saturation::instance->add(q_num_, *strong_);
+		}
 		if(subjects_->size() == 0)
 			return;
 		unsigned left;
@@ -83,17 +109,34 @@ struct hit_filter
 	}
 
 	void operator()(int i, const sequence &seq, int score)
-	{ push_hit(ref_seqs::data_->position(seq.data()+config.window-Const::seed_anchor)); stats_.inc(Statistics::GAPPED_HITS); }
+	{
+		const Loc subject = ref_seqs::data_->position(seq.data()+config.window-Const::seed_anchor);
+		push_hit(subject);
+		if(cache_)
+			cache_extent(subject, (*extents_)[i].first, (*extents_)[i].second);
+		stats_.inc(Statistics::GAPPED_HITS);
+	}
 
 private:
 
+	void cache_extent(Loc subject, unsigned delta, unsigned len)
+	{
+		if(cache_)
+			cache_->insert(q_pos_ - delta, subject - delta, len);
+	}
+
 	unsigned q_num_, seed_offset_;
 	Statistics  &stats_;
 	Loc q_pos_;
 	Trace_pt_buffer::Iterator &out_;
+	Diagonal_cache::Table *cache_;
 	Tls<vector<sequence> > subjects_;
+	Tls<vector<pair<unsigned,unsigned> > > extents_;
+	Tls<vector<unsigned> > strong_;
 	
 	static TLS_PTR vector<sequence> *subjects_ptr;
+	static TLS_PTR vector<pair<unsigned,unsigned> > *extents_ptr;
+	static TLS_PTR vector<unsigned> *strong_ptr;
 
 };
 
@@ -0,0 +1,77 @@
+/****
+Copyright (c) 2016, University of Tuebingen, Benjamin Buchfink
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification, are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this list of conditions and the following disclaimer.
+
+2. Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the following disclaimer in the documentation and/or other materials provided with the distribution.
+
+3. Neither the name of the copyright holder nor the names of its contributors may be used to endorse or promote products derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+****/
+#ifndef INDEX_FPS_H_
+#define INDEX_FPS_H_
+
+#include <vector>
+#include "../basic/const.h"
+#include "../basic/config.h"
+#include "../data/sorted_list.h"
+#include "../data/sequence_set.h"
+#include "../util/thread.h"
+#include "sse_dist.h"
+
+using std::vector;
+
+/* Fingerprints of all positions of a seed index, stored contiguously per
+seed partition in index order. Stage 1 reads the fingerprints of a seed hit
+group sequentially from here instead of gathering them from the sequence
+data. */
+struct Index_fps
+{
+
+	Index_fps(const sorted_list &idx, const Sequence_set &seqs):
+		idx_ (idx)
+	{
+		Build_context context (idx, seqs, *this);
+		launch_scheduled_thread_pool(context, Const::seedp, config.threads_);
+	}
+
+	/* Returns the fingerprints of the seed hit group at the iterator
+	position in partition p. */
+	const Finger_print* get(unsigned p, const sorted_list::const_iterator &i) const
+	{ return data_[p].data() + idx_.offset(p, i); }
+
+private:
+
+	struct Build_context
+	{
+		Build_context(const sorted_list &idx, const Sequence_set &seqs, Index_fps &fps):
+			idx (idx),
+			seqs (seqs),
+			fps (fps)
+		{ }
+		void operator()(unsigned thread_id, unsigned seedp) const
+		{
+			vector<Finger_print> &v = fps.data_[seedp];
+			v.clear();
+			for(sorted_list::const_iterator i = idx.get_partition_cbegin(seedp); !i.at_end(); ++i)
+				for(unsigned j=0;j<i.n;++j)
+					v.push_back(Finger_print(seqs.data(i[j])));
+		}
+		const sorted_list &idx;
+		const Sequence_set &seqs;
+		Index_fps &fps;
+	};
+
+	const sorted_list &idx_;
+	vector<Finger_print> data_[Const::seedp];
+
+};
+
+#endif /* INDEX_FPS_H_ */
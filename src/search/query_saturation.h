@@ -0,0 +1,85 @@
+/****
+Copyright (c) 2016, University of Tuebingen, Benjamin Buchfink
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification, are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this list of conditions and the following disclaimer.
+
+2. Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the following disclaimer in the documentation and/or other materials provided with the distribution.
+
+3. Neither the name of the copyright holder nor the names of its contributors may be used to endorse or promote products derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+****/
+
+#ifndef QUERY_SATURATION_H_
+#define QUERY_SATURATION_H_
+
+#include <vector>
+#include <limits>
+#include <algorithm>
+#include "../basic/config.h"
+#include "../basic/value.h"
+#include "../data/queries.h"
+#include "../util/tinythread.h"
+
+using std::vector;
+
+/* Per query set of subjects with a strong seed hit, i.e. a hit whose
+ungapped score alone passes the hit filter. The sets are updated
+concurrently while a shape is searched and hold at most max-target-seqs
+subjects each. Once a shape is finished, queries with strong hits in
+max-target-seqs distinct subjects are flagged and skipped by the search of
+the remaining shapes of the reference block. */
+struct Query_saturation
+{
+
+	Query_saturation(size_t n_queries):
+		limit_ ((size_t)std::min(config.max_alignments, (uint64_t)std::numeric_limits<unsigned>::max())),
+		subjects_ (n_queries),
+		saturated_ (n_queries)
+	{ }
+
+	/* Adds the sorted, unique subject ids of the strong hits of a query
+	context. */
+	void add(unsigned query_context, const vector<unsigned> &subjects)
+	{
+		const unsigned q = query_context / align_mode.query_contexts;
+		vector<unsigned> &v = subjects_[q];
+		tthread::mutex &mtx = mtx_[q & (n_locks - 1)];
+		mtx.lock();
+		for(vector<unsigned>::const_iterator i=subjects.begin();i!=subjects.end() && v.size()<limit_;++i) {
+			const vector<unsigned>::iterator j = std::lower_bound(v.begin(), v.end(), *i);
+			if(j == v.end() || *j != *i)
+				v.insert(j, *i);
+		}
+		mtx.unlock();
+	}
+
+	void update()
+	{
+		for(size_t i=0;i<subjects_.size();++i)
+			saturated_[i] = subjects_[i].size() >= limit_;
+	}
+
+	bool saturated(Loc q_pos) const
+	{ return saturated_[query_seqs::data_->local_position(q_pos).first / align_mode.query_contexts] != 0; }
+
+	static Query_saturation *instance;
+
+private:
+
+	enum { n_locks = 1024 };
+
+	const size_t limit_;
+	vector<vector<unsigned> > subjects_;
+	vector<char> saturated_;
+	tthread::mutex mtx_[n_locks];
+
+};
+
+#endif /* QUERY_SATURATION_H_ */
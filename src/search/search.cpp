@@ -19,26 +19,30 @@ LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR P
 #include "align_range.h"
 
 Trace_pt_buffer* Trace_pt_buffer::instance;
+Diagonal_cache* Diagonal_cache::instance;
+Query_saturation* Query_saturation::instance;
 const Reduction Halfbyte_finger_print::reduction("KR E D Q N C G H LM FY VI W P S T A");
 TLS_PTR vector<sequence>* hit_filter::subjects_ptr;
+TLS_PTR vector<pair<unsigned,unsigned> >* hit_filter::extents_ptr;
+TLS_PTR vector<unsigned>* hit_filter::strong_ptr;
 
 const unsigned tile_size[] = { 1024, 128 };
 
 struct Range_ref
 {
-	Range_ref(vector<Finger_print>::const_iterator q_begin, vector<Finger_print>::const_iterator s_begin):
+	Range_ref(const Finger_print *q_begin, const Finger_print *s_begin):
 		q_begin(q_begin),
 		s_begin(s_begin)
 	{}
-	const vector<Finger_print>::const_iterator q_begin, s_begin;
+	const Finger_print *const q_begin, *const s_begin;
 };
 
 #define FAST_COMPARE2(q, s, stats, q_ref, s_ref, q_offset, s_offset, hits) if (q.match(s) >= config.min_identities) stats.inc(Statistics::TENTATIVE_MATCHES1)
 #define FAST_COMPARE(q, s, stats, q_ref, s_ref, q_offset, s_offset, hits) if (q.match(s) >= config.min_identities) hits.push_back(Stage1_hit(q_ref, q_offset, s_ref, s_offset))
 
-void query_register_search(vector<Finger_print>::const_iterator q,
-	vector<Finger_print>::const_iterator s,
-	vector<Finger_print>::const_iterator s_end,
+void query_register_search(const Finger_print *q,
+	const Finger_print *s,
+	const Finger_print *s_end,
 	const Range_ref &ref,
 	vector<Stage1_hit> &hits,
 	Statistics &stats)
@@ -46,7 +50,7 @@ void query_register_search(vector<Finger_print>::const_iterator q,
 	const unsigned q_ref = unsigned(q - ref.q_begin);
 	unsigned s_ref = unsigned(s - ref.s_begin);
 	Finger_print q1 = *(q++), q2 = *(q++), q3 = *(q++), q4 = *(q++), q5=*(q++),q6=*q;
-	const vector<Finger_print>::const_iterator end2 = s_end - (s_end - s) % 4;
+	const Finger_print *const end2 = s_end - (s_end - s) % 4;
 	for (; s < end2; ) {
 		Finger_print s1 = *(s++), s2 = *(s++), s3 = *(s++), s4 = *(s++);
 		stats.inc(Statistics::SEED_HITS, 6 * 4);
@@ -88,10 +92,10 @@ void query_register_search(vector<Finger_print>::const_iterator q,
 	}
 }
 
-void inner_search(vector<Finger_print>::const_iterator q,
-	vector<Finger_print>::const_iterator q_end,
-	vector<Finger_print>::const_iterator s,
-	vector<Finger_print>::const_iterator s_end,
+void inner_search(const Finger_print *q,
+	const Finger_print *q_end,
+	const Finger_print *s,
+	const Finger_print *s_end,
 	const Range_ref &ref,
 	vector<Stage1_hit> &hits,
 	Statistics &stats)
@@ -99,7 +103,7 @@ void inner_search(vector<Finger_print>::const_iterator q,
 	unsigned q_ref = unsigned(q - ref.q_begin);
 	for (; q < q_end; ++q) {
 		unsigned s_ref = unsigned(s - ref.s_begin);
-		for (vector<Finger_print>::const_iterator s2 = s; s2 < s_end; ++s2) {
+		for (const Finger_print *s2 = s; s2 < s_end; ++s2) {
 			stats.inc(Statistics::SEED_HITS);
 			FAST_COMPARE((*q), *s2, stats, q_ref, s_ref, 0, 0, hits);
 			++s_ref;
@@ -108,10 +112,10 @@ void inner_search(vector<Finger_print>::const_iterator q,
 	}
 }
 
-void tiled_search(vector<Finger_print>::const_iterator q,
-	vector<Finger_print>::const_iterator q_end,
-	vector<Finger_print>::const_iterator s,
-	vector<Finger_print>::const_iterator s_end,
+void tiled_search(const Finger_print *q,
+	const Finger_print *q_end,
+	const Finger_print *s,
+	const Finger_print *s_end,
 	const Range_ref &ref,
 	vector<Stage1_hit> &hits,
 	Statistics &stats,
@@ -121,7 +125,7 @@ void tiled_search(vector<Finger_print>::const_iterator q,
 	case 0:
 	case 1:
 		for (; q < q_end; q += std::min(q_end - q, (ptrdiff_t)tile_size[level]))
-			for (vector<Finger_print>::const_iterator s2 = s; s2 < s_end; s2 += std::min(s_end - s2, (ptrdiff_t)tile_size[level]))
+			for (const Finger_print *s2 = s; s2 < s_end; s2 += std::min(s_end - s2, (ptrdiff_t)tile_size[level]))
 				tiled_search(q, q + std::min(q_end - q, (ptrdiff_t)tile_size[level]), s2, s2 + std::min(s_end - s2, (ptrdiff_t)tile_size[level]), ref, hits, stats, level+1);
 		break;
 	case 2:
@@ -153,7 +157,9 @@ void search_seed(const sorted_list::const_iterator &q,
 	const sorted_list::const_iterator &s,
 	Statistics &stats,
 	Trace_pt_buffer::Iterator &out,
-	const unsigned sid)
+	const unsigned sid,
+	const Finger_print *q_fps,
+	Diagonal_cache::Table *cache)
 {
 	//cout << q.n << ' ' << s.n << endl;
 	/*if (q.n > config.hit_cap)
@@ -163,10 +169,13 @@ void search_seed(const sorted_list::const_iterator &q,
 	vector<Finger_print> &vq(get_tls(vq_ptr)), &vs(get_tls(vs_ptr));
 	vector<Stage1_hit> &hits(get_tls(hits_ptr));
 	hits.clear();
-	load_fps2(q, vq, *query_seqs::data_);
+	if(q_fps == 0) {
+		load_fps2(q, vq, *query_seqs::data_);
+		q_fps = vq.data();
+	}
 	load_fps(s, vs, *ref_seqs::data_);
-	tiled_search(vq.begin(), vq.end(), vs.begin(), vs.end(), Range_ref(vq.begin(), vs.begin()), hits, stats, 0);
+	tiled_search(q_fps, q_fps + q.n, vs.data(), vs.data() + vs.size(), Range_ref(q_fps, vs.data()), hits, stats, 0);
 	std::sort(hits.begin(), hits.end());
 	stats.inc(Statistics::TENTATIVE_MATCHES1, hits.size());
-	stage2_search(q, s, hits, stats, out, sid);
+	stage2_search(q, s, hits, stats, out, sid, cache);
 }
\ No newline at end of file
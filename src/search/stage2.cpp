@@ -25,13 +25,18 @@ void search_query_offset(Loc q,
 	vector<Stage1_hit>::const_iterator hits_end,
 	Statistics &stats,
 	Trace_pt_buffer::Iterator &out,
-	const unsigned sid)
+	const unsigned sid,
+	Diagonal_cache::Table *cache)
 {
+	if (Query_saturation::instance && Query_saturation::instance->saturated(q))
+		return;
 	const Letter* query = query_seqs::data_->data(q);
-	hit_filter hf(stats, q, out);
+	hit_filter hf(stats, q, out, cache);
 
 	for (vector<Stage1_hit>::const_iterator i = hits; i < hits_end; ++i) {
 		const Loc s_pos = s[i->s];
+		if (cache && cache->contains(q, s_pos))
+			continue;
 		const Letter* subject = ref_seqs::data_->data(s_pos);
 
 		unsigned delta, len;
@@ -47,7 +52,7 @@ void search_query_offset(Loc q,
 #endif
 
 		stats.inc(Statistics::TENTATIVE_MATCHES3);
-		hf.push(s_pos, score);
+		hf.push(s_pos, score, delta, len);
 	}
 
 	hf.finish();
@@ -58,10 +63,11 @@ void stage2_search(const sorted_list::const_iterator &q,
 	const vector<Stage1_hit> &hits,
 	Statistics &stats,
 	Trace_pt_buffer::Iterator &out,
-	const unsigned sid)
+	const unsigned sid,
+	Diagonal_cache::Table *cache)
 {
 	typedef Map<vector<Stage1_hit>::const_iterator, Stage1_hit::Query> Map_t;
 	Map_t map(hits.begin(), hits.end());
 	for (Map_t::Iterator i = map.begin(); i.valid(); ++i)
-		search_query_offset(q[i.begin()->q], s, i.begin(), i.end(), stats, out, sid);
+		search_query_offset(q[i.begin()->q], s, i.begin(), i.end(), stats, out, sid, cache);
 }
\ No newline at end of file
@@ -100,7 +100,11 @@ struct Trace_pt_buffer : public Async_buffer<hit>
 	Trace_pt_buffer(size_t input_size, const string &tmpdir, bool mem_buffered):
 		Async_buffer<hit> (input_size, tmpdir, mem_buffered ? mem_bins : file_bins)
 	{ }
-	enum { mem_bins = 1, file_bins = 4 };
+	/* Two file bins are resident during alignment, the one being aligned and
+	the one being loaded, so the file bins are half the size that a single
+	resident bin would be given. The write blocks of the threads do not grow
+	with the bin count and are freed before the bins are loaded. */
+	enum { mem_bins = 1, file_bins = 8 };
 	static Trace_pt_buffer *instance;
 };
 
@@ -22,15 +22,27 @@ Author: Benjamin Buchfink
 #define ASYNC_BUFFER_H_
 
 #include <vector>
+#include <algorithm>
+#include <deque>
 #include <exception>
+#include <iostream>
 #include "../basic/config.h"
 #include "temp_file.h"
+#include "tinythread.h"
 
 using std::vector;
 using std::string;
 using std::endl;
 
-const unsigned async_buffer_max_bins = 4;
+const unsigned async_buffer_max_bins = 8;
+
+/* Elements buffered per thread, split evenly among the bins, so that more
+bins do not take more memory. */
+const size_t async_buffer_thread_size = (size_t)1<<18;
+
+/* Bytes of full blocks that may be queued for the writer thread, regardless
+of the number of threads and bins. */
+const size_t async_buffer_max_pending = (size_t)1<<24;
 
 template<typename _t>
 struct Async_buffer
@@ -40,7 +52,11 @@ struct Async_buffer
 
 	Async_buffer(size_t input_count, const string &tmpdir, unsigned bins):
 		bins_ (bins),
-		bin_size_ ((input_count + bins_ - 1) / bins_)
+		bin_size_ ((input_count + bins_ - 1) / bins_),
+		block_size_ (async_buffer_thread_size / bins_),
+		max_pending_ (std::max(async_buffer_max_pending / (block_size_ * sizeof(_t)), (size_t)1)),
+		closed_ (false),
+		iterators_ (config.threads_)
 	{
 		log_stream << "Async_buffer() " << input_count << ',' << bin_size_ << endl;
 		for(unsigned j=0;j<config.threads_;++j)
@@ -48,6 +64,22 @@ struct Async_buffer
 				tmp_file_.push_back(Temp_file ());
 				size_.push_back(0);
 			}
+		writer_ = new tthread::thread(writer_worker, (void*)this);
+	}
+
+	/* Buffers are expected to be closed explicitly so that writer errors reach
+	the caller. A destructor running during stack unwinding must not throw, so
+	errors are only reported here. */
+	~Async_buffer()
+	{
+		if(!closed_)
+			try {
+				close();
+			} catch(std::exception &e) {
+				std::cerr << "Error: " << e.what() << endl;
+			}
+		for(typename vector<Vector*>::iterator i=free_.begin();i!=free_.end();++i)
+			delete *i;
 	}
 
 	struct Iterator
@@ -56,39 +88,71 @@ struct Async_buffer
 			parent_ (parent),
 			thread_num_ (thread_num)
 		{
-			for(unsigned i=0;i<parent.bins_;++i) {
-				size_[i] = 0;
-				out_[i] = parent.get_out(thread_num_, i);
-			}
+			for(unsigned i=0;i<parent.bins_;++i)
+				buffer_[i] = parent.get_buffer();
 		}
 		void push(const _t &x)
 		{
 			const unsigned bin = (unsigned)(x / parent_.bin_size_);
 			assert(bin < parent_.bins());
-			buffer_[bin*buffer_size+(size_[bin]++)] = x;
-			if(size_[bin] == buffer_size)
+			buffer_[bin]->push_back(x);
+			if(buffer_[bin]->size() == parent_.block_size_)
 				flush(bin);
 		}
 		void flush(unsigned bin)
 		{
-			out_[bin]->typed_write(&buffer_[bin*buffer_size], size_[bin]);
-			parent_.add_size(thread_num_, bin, size_[bin]);
-			size_[bin] = 0;
+			if(buffer_[bin]->empty())
+				return;
+			parent_.add_size(thread_num_, bin, buffer_[bin]->size());
+			parent_.write(thread_num_, bin, buffer_[bin]);
+			buffer_[bin] = parent_.get_buffer();
 		}
 		~Iterator()
 		{
-			for(unsigned bin=0;bin<parent_.bins_;++bin)
+			for(unsigned bin=0;bin<parent_.bins_;++bin) {
 				flush(bin);
+				parent_.recycle(buffer_[bin]);
+			}
 		}
 	private:
-		enum { buffer_size = 65536 };
-		_t buffer_[async_buffer_max_bins*buffer_size];
-		size_t size_[async_buffer_max_bins];
-		Temp_file* out_[async_buffer_max_bins];
+		Vector* buffer_[async_buffer_max_bins];
 		Async_buffer &parent_;
 		const unsigned thread_num_;
+		friend struct Async_buffer;
 	};
 
+	/* Returns the persistent output iterator of a worker thread. Trace points
+	are accumulated across seed partitions and shapes and are only written out
+	in full blocks by the writer thread until close() is called. */
+	Iterator& get_iterator(unsigned thread_id)
+	{
+		assert(thread_id < iterators_.size());
+		if(iterators_[thread_id] == 0)
+			iterators_[thread_id] = new Iterator (*this, thread_id);
+		return *iterators_[thread_id];
+	}
+
+	/* Flushes the iterators and waits for the writer. The blocks are freed
+	here, so that they are not resident while the bins are loaded. */
+	void close()
+	{
+		for(typename vector<Iterator*>::iterator i=iterators_.begin();i!=iterators_.end();++i) {
+			delete *i;
+			*i = 0;
+		}
+		mtx_.lock();
+		closed_ = true;
+		mtx_.unlock();
+		cond_.notify_all();
+		writer_->join();
+		delete writer_;
+		for(typename vector<Vector*>::iterator i=free_.begin();i!=free_.end();++i)
+			delete *i;
+		free_.clear();
+		if(!error_.empty())
+			throw std::runtime_error(error_);
+	}
+
 	size_t load(vector<_t> &data, unsigned bin) const
 	{
 		static size_t total_size;
@@ -118,16 +182,95 @@ struct Async_buffer
 
 private:
 
+	struct Write_job
+	{
+		Write_job(Temp_file *out, Vector *buffer):
+			out (out),
+			buffer (buffer)
+		{ }
+		Temp_file *out;
+		Vector *buffer;
+	};
+
 	Temp_file* get_out(unsigned threadid, unsigned bin)
 	{ return &tmp_file_[threadid*bins_+bin]; }
 
 	void add_size(unsigned thread_id, unsigned bin, size_t n)
 	{ size_[thread_id*bins_+bin] += n; }
 
+	Vector* get_buffer()
+	{
+		Vector *v = 0;
+		mtx_.lock();
+		if(!free_.empty()) {
+			v = free_.back();
+			free_.pop_back();
+		}
+		mtx_.unlock();
+		if(v == 0) {
+			v = new Vector;
+			v->reserve(block_size_);
+		}
+		return v;
+	}
+
+	void recycle(Vector *v)
+	{
+		v->clear();
+		mtx_.lock();
+		free_.push_back(v);
+		mtx_.unlock();
+	}
+
+	void write(unsigned thread_id, unsigned bin, Vector *v)
+	{
+		mtx_.lock();
+		while(queue_.size() >= max_pending_)
+			cond_.wait(mtx_);
+		queue_.push_back(Write_job (get_out(thread_id, bin), v));
+		mtx_.unlock();
+		cond_.notify_all();
+	}
+
+	static void writer_worker(void *p)
+	{
+		Async_buffer &b = *(Async_buffer*)p;
+		for(;;) {
+			b.mtx_.lock();
+			while(b.queue_.empty() && !b.closed_)
+				b.cond_.wait(b.mtx_);
+			if(b.queue_.empty()) {
+				b.mtx_.unlock();
+				return;
+			}
+			const Write_job job = b.queue_.front();
+			b.queue_.pop_front();
+			b.mtx_.unlock();
+			b.cond_.notify_all();
+			try {
+				if(b.error_.empty())
+					job.out->typed_write(job.buffer->data(), job.buffer->size());
+			} catch(std::exception &e) {
+				b.error_ = e.what();
+			}
+			b.recycle(job.buffer);
+		}
+	}
+
 	const unsigned bins_;
 	const size_t bin_size_;
+	const size_t block_size_;
+	const size_t max_pending_;
+	bool closed_;
 	vector<size_t> size_;
 	vector<Temp_file> tmp_file_;
+	vector<Iterator*> iterators_;
+	vector<Vector*> free_;
+	std::deque<Write_job> queue_;
+	string error_;
+	tthread::mutex mtx_;
+	tthread::condition_variable cond_;
+	tthread::thread *writer_;
 
 };
 
@@ -0,0 +1,95 @@
+/****
+Copyright (c) 2016, University of Tuebingen, Benjamin Buchfink
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification, are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this list of conditions and the following disclaimer.
+
+2. Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the following disclaimer in the documentation and/or other materials provided with the distribution.
+
+3. Neither the name of the copyright holder nor the names of its contributors may be used to endorse or promote products derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+****/
+
+#ifndef BGZF_H_
+#define BGZF_H_
+
+#include <string.h>
+#include <stdint.h>
+#include <stdexcept>
+#include <algorithm>
+#include <zlib.h>
+#include "text_buffer.h"
+#include "binary_file.h"
+
+/* Blocked gzip format used by BAM files: a sequence of independent gzip
+members of at most 64 KB that each carry their compressed size in an extra
+field. Blocks are independent, so buffers can be compressed in parallel and
+the results concatenated in input order. */
+struct Bgzf
+{
+
+	enum { max_input = 0xff00, header_size = 18, footer_size = 8 };
+
+	/* Appends the BGZF blocks of data[0..n) to out. */
+	static void compress(const char *data, size_t n, Text_buffer &out)
+	{
+		static const unsigned char header[header_size] = { 0x1f, 0x8b, 8, 4, 0, 0, 0, 0, 0, 0xff, 6, 0, 'B', 'C', 2, 0, 0, 0 };
+		z_stream strm;
+		strm.zalloc = Z_NULL;
+		strm.zfree = Z_NULL;
+		strm.opaque = Z_NULL;
+		if (deflateInit2(&strm, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+			throw std::runtime_error("Error initializing BGZF compression.");
+		for (size_t i = 0; i < n; i += max_input) {
+			const size_t l = std::min(n - i, (size_t)max_input);
+			const size_t bound = deflateBound(&strm, (uLong)l);
+			out.reserve(header_size + bound + footer_size);
+			unsigned char *block = (unsigned char*)(char*)out;
+			memcpy(block, header, header_size);
+			strm.next_in = (Bytef*)(data + i);
+			strm.avail_in = (uInt)l;
+			strm.next_out = block + header_size;
+			strm.avail_out = (uInt)bound;
+			if (deflate(&strm, Z_FINISH) != Z_STREAM_END)
+				throw std::runtime_error("Error in BGZF compression.");
+			const size_t size = header_size + strm.total_out + footer_size;
+			unsigned char *footer = block + header_size + strm.total_out;
+			set_uint16(block + 16, (unsigned)(size - 1));
+			set_uint32(footer, (uint32_t)crc32(crc32(0, Z_NULL, 0), (const Bytef*)(data + i), (uInt)l));
+			set_uint32(footer + 4, (uint32_t)l);
+			out += size;
+			deflateReset(&strm);
+		}
+		deflateEnd(&strm);
+	}
+
+	/* Empty block marking the end of a BGZF file. */
+	static void write_eof(Output_stream &f)
+	{
+		static const char eof[] = "\x1f\x8b\x08\x04\x00\x00\x00\x00\x00\xff\x06\x00\x42\x43\x02\x00\x1b\x00\x03\x00\x00\x00\x00\x00\x00\x00\x00\x00";
+		f.write(eof, sizeof(eof) - 1);
+	}
+
+private:
+
+	static void set_uint16(unsigned char *p, unsigned x)
+	{
+		p[0] = (unsigned char)x;
+		p[1] = (unsigned char)(x >> 8);
+	}
+
+	static void set_uint32(unsigned char *p, uint32_t x)
+	{
+		set_uint16(p, x & 0xffff);
+		set_uint16(p + 2, x >> 16);
+	}
+
+};
+
+#endif /* BGZF_H_ */
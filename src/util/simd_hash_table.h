@@ -0,0 +1,169 @@
+/****
+Copyright (c) 2016, University of Tuebingen, Benjamin Buchfink
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification, are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this list of conditions and the following disclaimer.
+
+2. Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the following disclaimer in the documentation and/or other materials provided with the distribution.
+
+3. Neither the name of the copyright holder nor the names of its contributors may be used to endorse or promote products derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+****/
+#ifndef SIMD_HASH_TABLE_H_
+#define SIMD_HASH_TABLE_H_
+
+#include <string.h>
+#include <stdint.h>
+#include "util.h"
+
+/* Open addressing hash table with a power of two number of groups of 16
+slots. Every slot has a control byte holding 7 bits of the hash, or 0x80 if
+the slot is empty. A lookup compares the control bytes of a whole group with
+one SSE2 instruction and probes the following groups linearly. */
+template<typename _K, typename _V, typename _H>
+class Simd_hash_table
+{
+
+public:
+
+	Simd_hash_table():
+		ctrl_ (0),
+		slots_ (0),
+		groups_ (0),
+		size_ (0)
+	{
+		alloc(1);
+	}
+
+	~Simd_hash_table()
+	{
+		delete[] ctrl_;
+		delete[] slots_;
+	}
+
+	void clear()
+	{
+		alloc(1);
+		size_ = 0;
+	}
+
+	/* Grows the table so that the given number of additional entries can be
+	inserted at a load factor of at most 7/8. */
+	void reserve(size_t n)
+	{
+		size_t groups = groups_;
+		while((size_ + n) * 8 > groups * group_size * 7)
+			groups *= 2;
+		if(groups > groups_)
+			rehash(groups);
+	}
+
+	void insert(_K key, _V value)
+	{
+		reserve(1);
+		const uint64_t h = _H()(key);
+		const uint8_t tag = uint8_t(h & 0x7F);
+		for(size_t g = (h >> 7) & (groups_ - 1);; g = (g + 1) & (groups_ - 1)) {
+			Slot *s = &slots_[g * group_size];
+			unsigned m = match(ctrl_[g], tag);
+			for(;m != 0;m &= m - 1) {
+				Slot &e = s[ctz(m)];
+				if(e.key == key) {
+					e.value = value;
+					return;
+				}
+			}
+			m = match(ctrl_[g], empty);
+			if(m != 0) {
+				const unsigned i = ctz(m);
+				reinterpret_cast<uint8_t*>(&ctrl_[g])[i] = tag;
+				s[i].key = key;
+				s[i].value = value;
+				++size_;
+				return;
+			}
+		}
+	}
+
+	/* Returns a pointer to the value of the key, or 0 if it is not in the
+	table. */
+	const _V* find(_K key) const
+	{
+		const uint64_t h = _H()(key);
+		const uint8_t tag = uint8_t(h & 0x7F);
+		for(size_t g = (h >> 7) & (groups_ - 1);; g = (g + 1) & (groups_ - 1)) {
+			const Slot *s = &slots_[g * group_size];
+			for(unsigned m = match(ctrl_[g], tag);m != 0;m &= m - 1)
+				if(s[ctz(m)].key == key)
+					return &s[ctz(m)].value;
+			if(match(ctrl_[g], empty) != 0)
+				return 0;
+		}
+	}
+
+	size_t size() const
+	{ return size_; }
+
+private:
+
+	enum { group_size = 16, empty = 0x80 };
+
+	struct Slot
+	{
+		_K key;
+		_V value;
+	};
+
+	static unsigned match(const __m128i &ctrl, uint8_t tag)
+	{ return (unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(ctrl, _mm_set1_epi8((char)tag))); }
+
+	static unsigned ctz(unsigned x)
+	{
+#ifdef _MSC_VER
+		unsigned long i;
+		_BitScanForward(&i, x);
+		return (unsigned)i;
+#else
+		return (unsigned)__builtin_ctz(x);
+#endif
+	}
+
+	void alloc(size_t groups)
+	{
+		delete[] ctrl_;
+		delete[] slots_;
+		groups_ = groups;
+		ctrl_ = new __m128i[groups_];
+		slots_ = new Slot[groups_ * group_size];
+		memset(ctrl_, empty, groups_ * sizeof(__m128i));
+	}
+
+	void rehash(size_t groups)
+	{
+		__m128i *ctrl = ctrl_;
+		Slot *slots = slots_;
+		const size_t n = groups_ * group_size;
+		ctrl_ = 0;
+		slots_ = 0;
+		alloc(groups);
+		size_ = 0;
+		for(size_t i=0;i<n;++i)
+			if(reinterpret_cast<const uint8_t*>(ctrl)[i] != empty)
+				insert(slots[i].key, slots[i].value);
+		delete[] ctrl;
+		delete[] slots;
+	}
+
+	__m128i *ctrl_;
+	Slot *slots_;
+	size_t groups_, size_;
+
+};
+
+#endif /* SIMD_HASH_TABLE_H_ */
@@ -21,40 +21,93 @@ Author: Benjamin Buchfink
 #ifndef TASK_QUEUE_H_
 #define TASK_QUEUE_H_
 
+#include <deque>
+#include <stdexcept>
+#include <iostream>
 #include "tinythread.h"
 
 // #define ENABLE_LOGGING
 
+/* Full-barrier atomic addition, returns the previous value. */
+inline long atomic_add(volatile long *p, long n)
+{
+#ifdef _MSC_VER
+	return _InterlockedExchangeAdd(p, n);
+#else
+	return __sync_fetch_and_add(p, n);
+#endif
+}
+
+/* Bounded queue of output slots. Worker threads obtain a slot with get(),
+fill it and hand it back with push(). All output is done by a dedicated
+writer thread which invokes the callback on finished slots.
+In ordered mode, the slots form a reorder ring that is written in the order
+in which the slots were handed out. Finished slots are published with atomic
+flags, so push() and the writer do not take the mutex; it is only used to
+sleep while the next slot is outstanding or the ring is full.
+In unordered mode, slots are written as soon as they are finished and
+recycled immediately, so that a slow task does not hold up the others.
+If the callback throws, the writer records the error and ends the queue so
+that get() stops handing out slots; finish() rethrows it on the calling
+thread. */
+
 template<typename _t, typename _callback>
 struct Task_queue
 {
 
-	Task_queue(size_t limit, _callback &callback):
+	Task_queue(size_t limit, _callback &callback, bool ordered = true):
 		queue_ (limit),
-		state_ (limit),
+		ready_ (new long[limit]),
 		head_ (0),
 		tail_ (0),
+		written_ (0),
 		limit_ (limit),
-		head_idx_ (0),
-		queued_ (0),
-		queued_size_ (0),
 		at_end_ (false),
-		callback_ (callback)
-	{ }
+		ordered_ (ordered),
+		callback_ (callback),
+		writer_waiting_ (0),
+		getters_waiting_ (0),
+		writer_ (0)
+	{
+		for(size_t i=0;i<limit;++i) {
+			ready_[i] = 0;
+			free_.push_back(i);
+		}
+		writer_ = new tthread::thread(ordered ? ordered_writer : unordered_writer, (void*)this);
+	}
 
-	volatile bool waiting() const
-	{ return tail_ - head_ >= limit_; }
+	/* A destructor running during stack unwinding must not throw, so writer
+	errors are only reported here. */
+	~Task_queue()
+	{
+		try {
+			finish();
+		} catch(std::exception &e) {
+			std::cerr << "Error: " << e.what() << std::endl;
+		}
+		delete[] ready_;
+	}
+
+	bool waiting() const
+	{ return ordered_ ? tail_ - head_ >= limit_ : free_.empty(); }
 
 	template<typename _init>
-	volatile bool get(size_t &n, _t*& res, _init &init)
+	bool get(size_t &n, _t*& res, _init &init)
 	{
 		{
 			mtx_.lock();
 #ifdef ENABLE_LOGGING
 			log_stream << "Task_queue get() thread=" << tthread::thread::get_current_thread_id() << " waiting=" << waiting() << " head=" << head_ << " tail=" << tail_ << endl;
 #endif
-			while(waiting() && !at_end_)
-				cond_.wait(mtx_);
+			while(!at_end_) {
+				atomic_add(&getters_waiting_, 1);
+				const bool full = waiting();
+				if(full)
+					cond_.wait(mtx_);
+				atomic_add(&getters_waiting_, -1);
+				if(!full)
+					break;
+			}
 			if(at_end_) {
 #ifdef ENABLE_LOGGING
 				log_stream << "Task_queue get() thread=" << tthread::thread::get_current_thread_id() << " quit" << endl;
@@ -62,8 +115,14 @@ struct Task_queue
 				mtx_.unlock();
 				return false;
 			}
-			n = tail_++;
-			res = &slot(n);
+			if(ordered_)
+				n = tail_ % limit_;
+			else {
+				n = free_.front();
+				free_.pop_front();
+			}
+			++tail_;
+			res = &queue_[n];
 			if(!init())
 				at_end_ = true;
 #ifdef ENABLE_LOGGING
@@ -79,73 +138,151 @@ struct Task_queue
 	void wake_all()
 	{ cond_.notify_all(); }
 
-	volatile void push(size_t n)
+	void push(size_t n)
 	{
-		mtx_.lock();
-		if(n == head_) {
-#ifdef ENABLE_LOGGING
-			log_stream << "Task_queue flush() thread=" << tthread::thread::get_current_thread_id() << " n=" << n << endl;
-#endif
-			mtx_.unlock();
-			flush();
-		} else {
 #ifdef ENABLE_LOGGING
-			message_stream << "Task_queue push() thread=" << tthread::thread::get_current_thread_id() << " n=" << n << " head=" << head_ << " size=" << queued_size_ << endl;
+		log_stream << "Task_queue push() thread=" << tthread::thread::get_current_thread_id() << " n=" << n << " head=" << head_ << endl;
 #endif
-			state_[idx(n)] = true;
-			++queued_;
-			queued_size_ += slot(n).size();
+		if(ordered_) {
+			atomic_add(&ready_[n], 1);
+			if(atomic_add(&writer_waiting_, 0))
+				notify();
+			return;
+		}
+		mtx_.lock();
+		done_.push_back(n);
+		mtx_.unlock();
+		cond_.notify_all();
+	}
+
+	/* Waits for the writer thread to write all pushed slots. Must only be
+	called after the workers have returned. Rethrows an error of the output
+	callback. */
+	void finish()
+	{
+		if(writer_ == 0)
+			return;
+		mtx_.lock();
+		at_end_ = true;
+		mtx_.unlock();
+		cond_.notify_all();
+		writer_->join();
+		delete writer_;
+		writer_ = 0;
+		if(!error_.empty())
+			throw std::runtime_error(error_);
+	}
+
+private:
+
+	/* Wakes threads sleeping on the condition. Taking the mutex ensures that
+	a thread which announced that it is going to sleep has done so. */
+	void notify()
+	{
+		mtx_.lock();
+		mtx_.unlock();
+		cond_.notify_all();
+	}
+
+	/* Invokes the callback on the writer thread. On error, the queue is ended
+	so that the workers stop obtaining slots and the writer can return
+	without waiting for the slots still outstanding. */
+	bool write(size_t n)
+	{
+		try {
+			callback_(queue_[n]);
+			return true;
+		} catch(std::exception &e) {
+			mtx_.lock();
+			error_ = e.what();
+			at_end_ = true;
 			mtx_.unlock();
+			cond_.notify_all();
+			return false;
 		}
 	}
 
-	volatile unsigned flush()
+	/* Writes the ring in order. A worker sets the flag of its slot before
+	checking writer_waiting_, and the writer sets writer_waiting_ before
+	checking the flag again, so a finished slot cannot be missed. */
+	static void ordered_writer(void *p)
 	{
-		bool next = false;
-		unsigned n = 0;
-		do {
-			callback_(slot(head_));
-			{
-				mtx_.lock();
-#ifdef ENABLE_LOGGING
-				log_stream << "Task_queue flush() thread=" << tthread::thread::get_current_thread_id() << " head=" << head_ << " waiting=" << tail_-head_ << "/" << limit_ << " size=" << queued_size_ << endl;
-#endif
-				state_[idx(head_)] = false;
-				++head_;
-				head_idx_ = (head_idx_ + 1) % limit_;
-				if (state_[idx(head_)]) {
-					next = true;
+		Task_queue &q = *(Task_queue*)p;
+		for(;;) {
+			const size_t n = q.head_ % q.limit_;
+			if(atomic_add(&q.ready_[n], 0) == 0) {
+				q.mtx_.lock();
+				atomic_add(&q.writer_waiting_, 1);
+				while(atomic_add(&q.ready_[n], 0) == 0 && !(q.at_end_ && q.head_ == q.tail_))
+					q.cond_.wait(q.mtx_);
+				atomic_add(&q.writer_waiting_, -1);
+				const bool done = atomic_add(&q.ready_[n], 0) == 0;
+				q.mtx_.unlock();
+				if(done)
+					return;
+			}
+
+			if(!q.write(n))
+				return;
+
 #ifdef ENABLE_LOGGING
-					log_stream << "Task_queue n=" << queued_ << endl;
+			log_stream << "Task_queue flush() head=" << q.head_ << " waiting=" << q.tail_-q.head_ << "/" << q.limit_ << endl;
 #endif
-					--queued_;
-					queued_size_ -= slot(head_).size();
-				}
-				else
-					next = false;
-				mtx_.unlock();
-			}
-			cond_.notify_one();
-			++n;
-		} while (next);
-		return n;
+			atomic_add(&q.ready_[n], -1);
+			++q.head_;
+			++q.written_;
+			if(atomic_add(&q.getters_waiting_, 0))
+				q.notify();
+		}
 	}
 
-private:
+	bool next(size_t &n) const
+	{
+		if(done_.empty())
+			return false;
+		n = done_.front();
+		return true;
+	}
+
+	static void unordered_writer(void *p)
+	{
+		Task_queue &q = *(Task_queue*)p;
+		size_t n;
+		for(;;) {
+			q.mtx_.lock();
+			while(!q.next(n) && !(q.at_end_ && q.written_ == q.tail_))
+				q.cond_.wait(q.mtx_);
+			if(!q.next(n)) {
+				q.mtx_.unlock();
+				return;
+			}
+			q.done_.pop_front();
+			q.mtx_.unlock();
 
-	size_t idx(size_t n) const
-	{ return (head_idx_ + n - head_)%limit_; }
+			if(!q.write(n))
+				return;
 
-	_t& slot(size_t n)
-	{ return queue_[idx(n)]; }
+			q.mtx_.lock();
+			q.free_.push_back(n);
+			++q.written_;
+			q.mtx_.unlock();
+			q.cond_.notify_all();
+		}
+	}
 
 	vector<_t> queue_;
-	vector<bool> state_;
+	volatile long *ready_;
+	std::deque<size_t> free_, done_;
 	tthread::mutex mtx_;
 	tthread::condition_variable cond_;
-	volatile size_t head_, tail_, limit_, head_idx_, queued_, queued_size_;
+	volatile size_t head_;
+	size_t tail_, written_, limit_;
 	bool at_end_;
+	const bool ordered_;
 	_callback &callback_;
+	volatile long writer_waiting_, getters_waiting_;
+	tthread::thread *writer_;
+	string error_;
 
 };
 
@@ -25,6 +25,8 @@ Author: Benjamin Buchfink
 #include <stdio.h>
 #include <stdexcept>
 #include <stdint.h>
+#include <string.h>
+#include <math.h>
 #include <limits>
 
 struct Text_buffer
@@ -32,14 +34,18 @@ struct Text_buffer
 
 	Text_buffer():
 		data_ (0),
-		ptr_ (data_)
+		ptr_ (data_),
+		end_ (data_)
 	{ }
 
 	void reserve(size_t n)
 	{
+		if (size_t(end_ - ptr_) >= n)
+			return;
 		const size_t s = ptr_ - data_, new_size = s + n + block_size - ((s+n) & (block_size-1));
 		data_ = (char*)realloc(data_, new_size);
 		ptr_ = data_ + s;
+		end_ = data_ + new_size;
 		if (data_ == 0) throw std::runtime_error("Failed to allocate memory.");
 	}
 
@@ -64,6 +70,13 @@ struct Text_buffer
 		return *this;
 	}
 
+	void write_raw(const char *s, size_t len)
+	{
+		reserve(len);
+		memcpy(ptr_, s, len);
+		ptr_ += len;
+	}
+
 	void write_c_str(const char* s)
 	{
 		const size_t l = strlen(s)+1;
@@ -121,31 +134,33 @@ struct Text_buffer
 
 	Text_buffer& operator<<(uint32_t x)
 	{
-		//write(x);
 		reserve(16);
-		ptr_ += sprintf(ptr_, "%u", x);
+		ptr_ = print_uint(ptr_, x);
 		return *this;
 	}
 
 	Text_buffer& operator<<(int x)
 	{
-		//write(x);
 		reserve(16);
-		ptr_ += sprintf(ptr_, "%i", x);
+		if (x < 0) {
+			*(ptr_++) = '-';
+			ptr_ = print_uint(ptr_, uint64_t(-int64_t(x)));
+		} else
+			ptr_ = print_uint(ptr_, (uint64_t)x);
 		return *this;
 	}
 
 	Text_buffer& operator<<(size_t x)
 	{
 		reserve(32);
-		ptr_ += sprintf(ptr_, "%llu", (unsigned long long)x);
+		ptr_ = print_uint(ptr_, x);
 		return *this;
 	}
 
 	Text_buffer& operator<<(double x)
 	{
 		reserve(32);
-		ptr_ += sprintf(ptr_, "%.1lf", x);
+		ptr_ = print_fixed1(ptr_, x);
 		return *this;
 	}
 
@@ -159,7 +174,7 @@ struct Text_buffer
 	Text_buffer& print_e(double x)
 	{
 		reserve(32);
-		ptr_ += sprintf(ptr_, "%.1le", x);
+		ptr_ = print_sci1(ptr_, x);
 		return *this;
 	}
 
@@ -180,8 +195,105 @@ struct Text_buffer
 	}
 
 protected:
+
+	static char* print_uint(char *p, uint64_t x)
+	{
+		static const char digits[] =
+			"00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+			"40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+			"8081828384858687888990919293949596979899";
+		char buf[20], *b = buf + 20;
+		while (x >= 100) {
+			const unsigned i = unsigned(x % 100) * 2;
+			x /= 100;
+			*(--b) = digits[i + 1];
+			*(--b) = digits[i];
+		}
+		if (x >= 10) {
+			*(--b) = digits[x * 2 + 1];
+			*(--b) = digits[x * 2];
+		} else
+			*(--b) = char('0' + x);
+		const size_t n = buf + 20 - b;
+		memcpy(p, b, n);
+		return p + n;
+	}
+
+	/* x * 10^k, exact for |k| <= 22 and within a few ulps otherwise. */
+	static double scale10(double x, int k)
+	{
+		static const double p10[] = { 1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+			1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22 };
+		if (k >= 0) {
+			for (; k > 22; k -= 22)
+				x *= 1e22;
+			return x * p10[k];
+		}
+		for (k = -k; k > 22; k -= 22)
+			x /= 1e22;
+		return x / p10[k];
+	}
+
+	/* The fast paths below fall back to sprintf whenever the scaled value is
+	close enough to a rounding tie that the scaling error could matter, so the
+	output always equals that of %.1lf and %.1le. */
+
+	static bool near_tie(double f)
+	{ return f > 0.5 - 1e-6 && f < 0.5 + 1e-6; }
+
+	static char* print_fixed1(char *p, double x)
+	{
+		if (!(x > 0.0 && x < 1e8))
+			return p + sprintf(p, "%.1lf", x);
+		const double t = x * 10.0;
+		uint64_t n = (uint64_t)t;
+		const double f = t - (double)n;
+		if (near_tie(f))
+			return p + sprintf(p, "%.1lf", x);
+		if (f > 0.5)
+			++n;
+		p = print_uint(p, n / 10);
+		*(p++) = '.';
+		*(p++) = char('0' + n % 10);
+		return p;
+	}
+
+	static char* print_sci1(char *p, double x)
+	{
+		if (x == 0.0 && 1.0 / x > 0.0) {
+			memcpy(p, "0.0e+00", 7);
+			return p + 7;
+		}
+		if (!(x >= 1e-300 && x < 1e300))
+			return p + sprintf(p, "%.1le", x);
+		int e = (int)floor(log10(x));
+		double t = scale10(x, 1 - e);
+		if (t < 10.0)
+			t = scale10(x, 1 - --e);
+		else if (t >= 100.0)
+			t = scale10(x, 1 - ++e);
+		unsigned n = (unsigned)t;
+		const double f = t - (double)n;
+		if (n < 10 || n >= 100 || near_tie(f))
+			return p + sprintf(p, "%.1le", x);
+		if (f > 0.5 && ++n == 100) {
+			n = 10;
+			++e;
+		}
+		*(p++) = char('0' + n / 10);
+		*(p++) = '.';
+		*(p++) = char('0' + n % 10);
+		*(p++) = 'e';
+		*(p++) = e < 0 ? '-' : '+';
+		if (e < 0)
+			e = -e;
+		if (e < 10)
+			*(p++) = '0';
+		return print_uint(p, (uint64_t)e);
+	}
+
 	enum { block_size = 65536 };
-	char *data_, *ptr_;
+	char *data_, *ptr_, *end_;
 
 };
 